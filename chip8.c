@@ -14,86 +14,129 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
 #include <SDL2/SDL.h>
+#include <SDL2/SDL_thread.h>
+
+#include "chip8_core.h"
+#include "chip8_profile.h"
+#include "chip8_rewind.h"
+#include "chip8_movie.h"
+#include "chip8_audio.h"
+#include "chip8_record.h"
+#include "chip8_input.h"
 
 typedef struct{
     SDL_Window * window;
     SDL_Renderer * renderer;
+    SDL_Texture * screen;   // 128x64 streaming texture , the part in use is stretched to the window
+    SDL_Texture * outlines[2]; // static pixel grids drawn over it in lores and hires , NULL when off
     SDL_AudioSpec want,have;
     SDL_AudioDeviceID dev;
+    audio_t * audio; // fed by the emulation thread , drained by the audio callback
 } sdl_t;
 
-typedef enum {    // Emulator States
-    QUIT,
-    RUNNING,
-    PAUSE,
-} state_t;
-
-// chip8-extension
-
-typedef enum {
-    CHIP8,
-    SUPERCHIP,
-    XOCHIP
-} extension_t;
+#define MAX_TURBO 1000
+#define MAX_REWIND_MB 4095 // rewind_bytes is 32 bits
+#define UNCAPPED_SLICE 10000 // instructions between clock checks when uncapped
+#define KEY_SLICES 8 // a frame runs in this many slices , key changes go in between
 
+// finished frames go from the emulation thread to the SDL thread through three
+// buffers : one being written , one on screen and one ready in between , so
+// neither side ever waits and a frame is never shown half drawn
 typedef struct{
-    uint32_t window_height;
-    uint32_t window_width;
-    uint32_t fg_color;
-    uint32_t bg_color;
-    uint32_t scale_factor; //  amount to scale a pixel to 20x
-    bool pixel_outlines;
-    uint32_t inst_per_second; // instructions per second  (clock rate )
-    uint32_t square_wave_freq;  // frequency of square sound
-    uint32_t audio_sample_rate; 
-    uint16_t volume; // how loud or not is the sound
-    extension_t current_extension; // current quirks/extension support
-} config_t;
+    uint64_t display[DISPLAY_HEIGHT][DISPLAY_WORDS];
+    uint64_t display2[DISPLAY_HEIGHT][DISPLAY_WORDS];
+    bool hires;
+    uint64_t pressed; // earliest press the program read since the frame before , 0 = none
+} frame_t;
 
+#define FRAME_FRESH 4u // set in middle while it holds a frame nobody has taken
 
 typedef struct{
-    uint16_t opcode;
-    uint16_t NNN; // 12bit address
-    uint8_t NN;   //8 bit constant
-    uint8_t N;     // 4 bit constant
-    uint8_t X;      // register
-    uint8_t Y;      // register
-} instruction_t;
-
+    frame_t frames[3];
+    atomic_uint middle; // index of the ready buffer | FRAME_FRESH
+    uint32_t back;      // emulation thread only
+    uint32_t front;     // SDL thread only
+} triple_buffer_t;
 
+// state shared by the SDL thread and the emulation thread
 typedef struct{
-    uint8_t ram[4096];
-    bool display[64*32];  // for DXYN  display [x y]
-    state_t state;
-    uint16_t stack[12]; // for tweleve nesting states 
-    uint16_t *stack_ptr;
-    uint8_t V[16]; // for all registers
-    uint16_t I; //index register for the address 
-    uint16_t PC; // program counter
-    uint8_t delay_timer; // Decrements at 60hz when >0
-    uint8_t sound_timer;  // Decrements at 60hz and plays tone when > 0
-    bool keypads[16]; //keypads
-    char * rom_name; // rom name
-    instruction_t  inst;
-} chip8_t;
+    chip8_t * chip8;   // belongs to the emulation thread once it starts
+    config_t * config;
+    sdl_t * sdl;
+    atomic_int state;  // state_t , changed by input
+    input_t * input;   // key changes from the SDL thread , and their latency
+    atomic_uint speed; // emulated seconds per real second , 1 or the turbo factor
+    atomic_bool rewinding; // backspace held , frames play backwards
+    atomic_uint volume; // changed by input , passed on to the audio thread with the voice
+    rewind_t * rewind; // emulation thread only , NULL when off
+    movie_t * movie;   // -m , keys recorded by the emulation thread , NULL when off
+    recorder_t * recorder; // -R and -T , fed by the emulation thread , NULL when off
+    triple_buffer_t display;
+    uint32_t frame_event; // pushed to wake the SDL thread for a new frame
+} emulator_t;
+
+static void init_triple_buffer(triple_buffer_t * tb){
+    tb->back = 0;
+    atomic_init(&tb->middle, 1);
+    tb->front = 2;
+}
 
+// emulation thread : hand the back buffer over and take the old middle one ,
+// true when that one was never taken
+static bool publish_frame(triple_buffer_t * tb){
+    const uint32_t old = atomic_exchange(&tb->middle, tb->back | FRAME_FRESH);
+    tb->back = old & 3;
+    return old & FRAME_FRESH;
+}
+
+// SDL thread : swap in the newest frame , false if nothing new came in
+static bool take_frame(triple_buffer_t * tb){
+    if(!(atomic_load(&tb->middle) & FRAME_FRESH)) return false;
+    tb->front = atomic_exchange(&tb->middle, tb->front) & 3;
+    return true;
+}
 
 void audio_callback(void * userdata , uint8_t * stream , int len){
-    config_t * config = (config_t *) userdata;
+    // length is in bytes so divide by 2
+    audio_render(userdata, (int16_t *) stream, len / 2);
+}
+
+// pixel outlines are a window sized grid in the background color , opaque on
+// each pixel's border and clear inside. it never changes , so it is built once
+// per resolution and costs one copy per frame whatever the scale factor is
+static SDL_Texture * create_outline_texture(sdl_t * sdl, const config_t * config, uint32_t cell){
+    const uint32_t width = config->window_width * config->scale_factor;
+    const uint32_t height = config->window_height * config->scale_factor;
+    const uint32_t border = (config->bg_color & 0xFFFFFF00) | 0xFF;
+
+    uint32_t * grid = calloc(width * height, sizeof(uint32_t));
+    if(!grid){
+        SDL_Log("Could not allocate the pixel outline grid\n");
+        return NULL;
+    }
 
-    int16_t * audio_data = (int16_t * ) stream;
-    static uint32_t running_sample_index = 0;
-    const int32_t square_wave_period = config->audio_sample_rate / config->square_wave_freq;
-    const int32_t half_square_wave_period = square_wave_period / 2;
+    for(uint32_t y = 0; y < height; y++){
+        const uint32_t cell_y = y % cell;
+        for(uint32_t x = 0; x < width; x++){
+            const uint32_t cell_x = x % cell;
+            if(cell_x == 0 || cell_y == 0 || cell_x == cell - 1 || cell_y == cell - 1)
+                grid[y * width + x] = border;
+        }
+    }
 
-    // length is in bytes so divide by 2
-    for(int i = 0;i < len/2 ; i++){
-        audio_data[i] = ((running_sample_index++ / half_square_wave_period) % 2) ?
-         config->volume : -config->volume ;
+    SDL_Texture * outlines = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_RGBA8888,
+                                               SDL_TEXTUREACCESS_STATIC, width, height);
+    if(outlines){
+        SDL_SetTextureBlendMode(outlines, SDL_BLENDMODE_BLEND);
+        SDL_UpdateTexture(outlines, NULL, grid, width * sizeof(uint32_t));
     }
+    else SDL_Log("SDL_CreateTexture Error : %s",SDL_GetError());
 
+    free(grid);
+    return outlines;
 }
 
 bool initSDl(sdl_t *sdl,config_t *config){
@@ -119,17 +162,39 @@ bool initSDl(sdl_t *sdl,config_t *config){
         return false;
     }
 
+    // RGBA8888 matches the 0xRRGGBBAA config colors , no conversion needed
+    sdl->screen = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_RGBA8888,
+                                    SDL_TEXTUREACCESS_STREAMING, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    if(!sdl->screen){
+        SDL_Log("SDL_CreateTexture Error : %s",SDL_GetError());
+        return false;
+    }
+    SDL_SetTextureBlendMode(sdl->screen, SDL_BLENDMODE_NONE);
+
+    // hires pixels are half as big , too small for a border below scale 4
+    if(config->pixel_outlines){
+        sdl->outlines[0] = create_outline_texture(sdl, config, config->scale_factor);
+        if(!sdl->outlines[0]) return false;
+        if(config->scale_factor >= 4){
+            sdl->outlines[1] = create_outline_texture(sdl, config, config->scale_factor / 2);
+            if(!sdl->outlines[1]) return false;
+        }
+    }
+
 
     // AUDIO
+    sdl->audio = audio_create(config->audio_sample_rate, config->square_wave_freq, 512);
+    if(!sdl->audio){
+        SDL_Log("Could not allocate the audio queue\n");
+        return false;
+    }
     sdl->want = (SDL_AudioSpec){
-        .freq = 44100,   // CD quality
+        .freq = config->audio_sample_rate,
         .format = AUDIO_S16LSB, // little endian
         .channels = 1,  // mono , 1 channel
         .samples = 512,
         .callback = audio_callback,
-        .userdata = config, // userdata passed to audio callback
-
-
+        .userdata = sdl->audio, // userdata passed to audio callback
     };
 
     sdl->dev = SDL_OpenAudioDevice(NULL,0, &sdl->want, &sdl->have, 0);
@@ -144,92 +209,113 @@ bool initSDl(sdl_t *sdl,config_t *config){
             SDL_Log("Could not get desired Audio Spec\n");
         }  
 
-    SDL_PauseAudioDevice(sdl->dev, 0); // Start playing audio
+    // plays from here on , silence is the envelope closing , not a paused device
+    SDL_PauseAudioDevice(sdl->dev, 0);
 
 
     return true;
 }
 
-bool init_chip8(chip8_t * chip8, char rom_name []){
-    const uint32_t starting_point = 0x200;
-    const uint8_t font[] = {
-        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-        0x20, 0x60, 0x20, 0x20, 0x70, // 1
-        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-    };
-    //load font
-
-    memcpy(&chip8->ram[0],font,sizeof(font));
-    //load rom
-
-    FILE * rom = fopen(rom_name,"rb");
-    if(!rom){
-        SDL_Log("Rom dosen't exist");
-        return false;
-    }
-    fseek(rom,0,SEEK_END);
-    const size_t rom_size = ftell(rom);
-    const size_t max_size = sizeof(chip8->ram) - starting_point;
-    rewind(rom);
-
-    if(rom_size > max_size){
-        SDL_Log("Rom size is too big ...");
-        return false;
-    }
-
-    if(fread(&chip8->ram[starting_point],rom_size,1,rom) != 1){
-        SDL_Log("Cannot read into the rom file ..");
-        return false;
-    }
-
-    fclose(rom);
-    
-
-    chip8->state = RUNNING;
-    chip8->PC = starting_point;
-    chip8->rom_name = rom_name;
-    chip8->stack_ptr = &chip8->stack[0];
-    return true;
-}
-
 void cleanupSDL(const sdl_t * sdl){
+    for(uint32_t i = 0; i < 2; i++) if(sdl->outlines[i]) SDL_DestroyTexture(sdl->outlines[i]);
+    if(sdl->screen) SDL_DestroyTexture(sdl->screen);
     SDL_DestroyRenderer(sdl->renderer);
     SDL_DestroyWindow(sdl->window);
     SDL_CloseAudioDevice(sdl->dev);
+    audio_destroy(sdl->audio);
     SDL_Quit(); // shutdown the SDL
 }
 
+// four colors as hex RRGGBB or RRGGBBAA , comma separated
+static bool parse_palette(const char * arg, uint32_t palette[4]){
+    const char * text = arg;
+    for(int i = 0; i < 4; i++){
+        char * end;
+        const uint32_t color = strtoul(text, &end, 16);
+        if(end - text == 6) palette[i] = color << 8 | 0xFF;
+        else if(end - text == 8) palette[i] = color;
+        else break;
+
+        if(i == 3 && *end == '\0') return true;
+        if(*end != ',') break;
+        text = end + 1;
+    }
+    fprintf(stderr,"Bad palette %s (four colors , RRGGBB or RRGGBBAA , comma separated)\n",arg);
+    return false;
+}
+
 //set up initial emulator configuration
 bool set_config_args(config_t * config,int argc, char ** argv){
     // set defaults
-    config -> window_height = 32;    // chip-8 original resolution
-    config -> window_width = 64;  
-    config->fg_color = 0xFFFFFFFF; // white
-    config->bg_color = 0x00000000; // black
-    config->scale_factor = 20;
-    config->inst_per_second = 700;
-    config->square_wave_freq = 440;
-    config->volume = 2500; // max = 320000 
-    config->audio_sample_rate = 44100; // cd quality
-    config->current_extension = CHIP8;
-    for(int i=1 ; i < argc ;i++){
-        (void)argv[i];  // prevernt compiler error
+    init_config(config);
+
+    // override defaults from arguments , the last one is the rom
+    for(int i=1 ; i < argc - 1 ;i++){
+        if(strcmp(argv[i], "-c") == 0 && i + 1 < argc - 1){
+            config->inst_per_second = strtoul(argv[++i], NULL, 0); // 0 = uncapped
+        }
+        else if(strcmp(argv[i], "-V") == 0){
+            config->cycles_per_frame = VIP_CYCLES_PER_FRAME; // COSMAC VIP timing
+            config->display_wait = true;
+        }
+        else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc - 1){
+            config->turbo_factor = strtoul(argv[++i], NULL, 0);
+        }
+        else if(strcmp(argv[i], "-d") == 0){
+            config->show_stats = true;
+        }
+        else if(strcmp(argv[i], "-e") == 0 && i + 1 < argc - 1){
+            if(!parse_extension(argv[++i], &config->current_extension)) return false;
+        }
+        else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc - 1){
+            const unsigned long mb = strtoul(argv[++i], NULL, 0); // MB , 0 = off
+            if(mb > MAX_REWIND_MB){
+                fprintf(stderr,"Rewind history of %lu MB is too big , at most %d\n",mb,MAX_REWIND_MB);
+                return false;
+            }
+            config->rewind_bytes = (uint32_t) mb << 20;
+        }
+        else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc - 1){ // -s like chip8-run , chip8-batch and chip8-env
+            config->seed = strtoul(argv[++i], NULL, 0);
+        }
+        else if(strcmp(argv[i], "-m") == 0 && i + 1 < argc - 1){
+            config->movie_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "-R") == 0 && i + 1 < argc - 1){
+            config->video_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "-T") == 0 && i + 1 < argc - 1){
+            config->trace_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc - 1){
+            if(!parse_palette(argv[++i], config->palette)) return false;
+            // plain chip8 draws in the first two
+            config->bg_color = config->palette[0];
+            config->fg_color = config->palette[1];
+        }
+        else {
+            fprintf(stderr,"Unknown option %s\n",argv[i]);
+            return false;
+        }
+    }
+
+    if(config->turbo_factor < 2) config->turbo_factor = 2;
+    if(config->turbo_factor > MAX_TURBO) config->turbo_factor = MAX_TURBO;
+
+    // an uncapped clock runs whatever fits between ticks , that can't be replayed
+    if(config->movie_path && config->inst_per_second == 0){
+        fprintf(stderr,"Recording a movie needs a capped clock (-c N)\n");
+        return false;
+    }
+    if(config->cycles_per_frame && config->inst_per_second == 0){
+        fprintf(stderr,"VIP timing (-V) sets the pace itself , drop -c 0\n");
+        return false;
+    }
+    // the trace steps one instruction at a time , the cycle schedule prices them as it runs them
+    if(config->cycles_per_frame && config->trace_path){
+        fprintf(stderr,"Traces aren't recorded with VIP timing (-V)\n");
+        return false;
     }
-    config->pixel_outlines = true;
-    //override defaults fom arguments(later)
     return true;
 }
 
@@ -244,457 +330,405 @@ void clearScreen(sdl_t * sdl ,config_t  * config){
     SDL_RenderClear(sdl->renderer);
 }
 
-void updateScreen(sdl_t  * sdl , config_t * config , chip8_t * chip8){
-    SDL_Rect rect = {.x = 0, .y = 0 , .w = config->scale_factor , .h = config->scale_factor};
-    
-    uint8_t fg_r = (config->fg_color >> 24) & 0xFF ;
-    uint8_t fg_g = (config->fg_color >> 16) & 0xFF ;
-    uint8_t fg_b = (config->fg_color >>  8) & 0xFF ;
-    uint8_t fg_a = (config->fg_color >>  0) & 0xFF ;
-
-    uint8_t bg_r = (config->bg_color >> 24) & 0xFF ;
-    uint8_t bg_g = (config->bg_color >> 16) & 0xFF ;
-    uint8_t bg_b = (config->bg_color >>  8) & 0xFF ;
-    uint8_t bg_a = (config->bg_color >>  0) & 0xFF ;
+// only called when something changed , and only the changed rows are uploaded.
+// lores uses the top left quarter of the texture , so switching resolution is
+// only a different source rectangle , nothing gets reallocated
+void updateScreen(sdl_t  * sdl , config_t * config , const frame_t * frame, uint64_t dirty_rows){
+    PROFILE_BEGIN(render);
+    static uint32_t pixels[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+
+    const uint32_t width = frame->hires ? DISPLAY_WIDTH : LORES_WIDTH;
+    const uint32_t height = frame->hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+    const uint32_t first_row = __builtin_ctzll(dirty_rows);
+    const uint32_t last_row = 63 - __builtin_clzll(dirty_rows);
+    const SDL_Rect rows = {.x = 0, .y = first_row, .w = width, .h = last_row - first_row + 1};
+    const SDL_Rect screen = {.x = 0, .y = 0, .w = width, .h = height};
+
+    if(config->current_extension == XOCHIP)
+        planes_to_pixels(frame->display, frame->display2, width, config->palette, pixels, first_row, last_row);
+    else
+        display_to_pixels(frame->display, width, config->fg_color, config->bg_color, pixels, first_row, last_row);
+    SDL_UpdateTexture(sdl->screen, &rows, &pixels[first_row * DISPLAY_WIDTH], DISPLAY_WIDTH * sizeof(uint32_t));
+
+    // the back buffer isn't kept between presents , so always copy the whole frame
+    SDL_RenderCopy(sdl->renderer, sdl->screen, &screen, NULL);
+    if(sdl->outlines[frame->hires]) SDL_RenderCopy(sdl->renderer, sdl->outlines[frame->hires], NULL, NULL);
 
-
-    for(uint32_t i = 0;i<sizeof(chip8->display);i++){
-        rect.x = (i % config->window_width) * config->scale_factor;
-        rect.y = (i / config->window_width) * config->scale_factor;
-
-
-        if(chip8->display[i]){
-            // pixel is on FG
-            SDL_SetRenderDrawColor(sdl->renderer, fg_r, fg_g, fg_b, fg_a);
-            SDL_RenderFillRect(sdl->renderer, &rect);
-
-            // if user requested pixel config
-            if(config->pixel_outlines == true){
-                SDL_SetRenderDrawColor(sdl->renderer, bg_r, bg_g, bg_b, bg_a);
-                SDL_RenderDrawRect(sdl->renderer, &rect);
-            }
-            
-        }
-        else {
-            // pixel is off BG
-            SDL_SetRenderDrawColor(sdl->renderer, bg_r, bg_g, bg_b, bg_a);
-            SDL_RenderFillRect(sdl->renderer, &rect);
-        }
-    }
-    
     SDL_RenderPresent(sdl->renderer);
+    PROFILE_END(render);
 }
 
 // chip8 Keypad
 
-void handle_input(chip8_t * chip8, config_t * config){
-    SDL_Event event;
-
-    while(SDL_PollEvent(&event)){
-        switch(event.type){
-            case SDL_QUIT:
-                chip8->state = QUIT;
-                return;
-            case SDL_KEYDOWN:
-            {
-                switch(event.key.keysym.sym){
-                    
-                    case SDLK_ESCAPE: 
-                        chip8->state = QUIT;
-                        return;
-
-                    case  SDLK_SPACE:
-                        //spacebar
-                        if(chip8->state == RUNNING){
-                            chip8->state = PAUSE;
-                            puts("=====PAUSED=====");
-                        } 
-                        else {
-                            chip8->state = RUNNING;
-                            puts("====RUNNNING=====");
-                        }
-                        break;
-                    
-                    
-                    // map qwerty to chip8 keypad
-                    case SDLK_1: chip8->keypads[0x1] = true; break;
-                    case SDLK_2: chip8->keypads[0x2] = true; break;
-                    case SDLK_3: chip8->keypads[0x3] = true; break;
-                    case SDLK_4: chip8->keypads[0xC] = true; break;
-
-                    case SDLK_q: chip8->keypads[0x4] = true; break;
-                    case SDLK_w: chip8->keypads[0x5] = true; break;
-                    case SDLK_e: chip8->keypads[0x6] = true; break;
-                    case SDLK_r: chip8->keypads[0xD] = true; break;
-
-                    case SDLK_a: chip8->keypads[0x7] = true; break;
-                    case SDLK_s: chip8->keypads[0x8] = true; break;
-                    case SDLK_d: chip8->keypads[0x9] = true; break;
-                    case SDLK_f: chip8->keypads[0xE] = true; break;
-
-                    case SDLK_z: chip8->keypads[0xA] = true; break;
-                    case SDLK_x: chip8->keypads[0x0] = true; break;
-                    case SDLK_c: chip8->keypads[0xB] = true; break;
-                    case SDLK_v: chip8->keypads[0xF] = true; break;
-
-
-                    case SDLK_UP:
-                        if(config->volume > 7500) config->volume = 8000;
-                        else config->volume +=500;
-                        break;
-
-                    case SDLK_DOWN:
-                        if(config->volume < 500 )config->volume = 0;
-                        else config->volume -=500; 
-
-
-
-                    default:
-                        break;
-                }
-                break;
-            }
-                
-            case SDL_KEYUP:
-            {
-                switch (event.key.keysym.sym) {
-                    case SDLK_1: chip8->keypads[0x1] = false; break;
-                    case SDLK_2: chip8->keypads[0x2] = false; break;
-                    case SDLK_3: chip8->keypads[0x3] = false; break;
-                    case SDLK_4: chip8->keypads[0xC] = false; break;
-                    case SDLK_q: chip8->keypads[0x4] = false; break;
-                    case SDLK_w: chip8->keypads[0x5] = false; break;
-                    case SDLK_e: chip8->keypads[0x6] = false; break;
-                    case SDLK_r: chip8->keypads[0xD] = false; break;
-                    case SDLK_a: chip8->keypads[0x7] = false; break;
-                    case SDLK_s: chip8->keypads[0x8] = false; break;
-                    case SDLK_d: chip8->keypads[0x9] = false; break;
-                    case SDLK_f: chip8->keypads[0xE] = false; break;
-                    case SDLK_z: chip8->keypads[0xA] = false; break;
-                    case SDLK_x: chip8->keypads[0x0] = false; break;
-                    case SDLK_c: chip8->keypads[0xB] = false; break;
-                    case SDLK_v: chip8->keypads[0xF] = false; break;
-                }
-                break;
-
-            }
-            break;
-            
-            
-            default:
-                break;   
-        }
-    }
+// queued with the time it really happened , SDL stamps events in
+// SDL_GetTicks milliseconds. repeats aren't changes
+static void set_key(emulator_t * emu, const SDL_Event * event, uint8_t key, bool down){
+    if(event->key.repeat) return;
+    const uint32_t age_ms = SDL_GetTicks() - event->key.timestamp;
+    const uint64_t at = SDL_GetPerformanceCounter() -
+                        (age_ms < 1000 ? (uint64_t) age_ms * SDL_GetPerformanceFrequency() / 1000 : 0);
+    if(!input_post(emu->input, at, key, down)) SDL_Log("Key queue full , key %X dropped\n", key);
 }
 
-//emulate chip8 instruction
-void emulate_instruction(chip8_t * chip8, config_t config){
-    chip8->inst.opcode = (chip8->ram[chip8->PC] << 8) | chip8->ram[chip8->PC+1];
-    chip8->PC +=2; // increment for next opcode
-
-    // fill out instruction format
-    chip8->inst.NNN = chip8->inst.opcode & 0x0FFF;
-    chip8->inst.NN = chip8->inst.opcode & 0x0FF;
-    chip8->inst.N = chip8->inst.opcode & 0x0F;
-    chip8->inst.X = (chip8->inst.opcode >> 8) & 0x0F;
-    chip8->inst.Y = (chip8->inst.opcode >> 4) & 0x0F;
-
-    switch((chip8->inst.opcode >> 12) & 0x0F){
-        case 0x0:
-            if(chip8->inst.NN == 0xE0){
-                memset(&chip8->display[0],false,sizeof(chip8->display));
-            } else if (chip8->inst.NN == 0xEE){
-                // return from subroutine
-                chip8->PC = *--chip8->stack_ptr;
-            } else {
-                //unimplimented opcode  calling for machine code 
-            }
-            break;
-
-        case 0x01:
-            chip8->PC = chip8->inst.NNN;
-            break;
-
-        case 0x02:
-            *chip8->stack_ptr++ = chip8->PC;
-            chip8->PC = chip8->inst.NNN;
-            break;
-
-        case 0x03:
-            {
-                // if vx == nn then skip next instruction
-                if(chip8->V[chip8->inst.X] == chip8->inst.NN) chip8->PC +=2;
-            }
-            break;
-
-        case 0x04:
-            {
-                // if vx == nn then skip next instruction
-                if(chip8->V[chip8->inst.X] != chip8->inst.NN) chip8->PC +=2;
-            }
-            break;
+// runs on the SDL thread , the machine only sees the results through atomics
+void handle_input(emulator_t * emu, const SDL_Event * event, bool * redraw){
+    config_t * config = emu->config;
 
-        case 0x05:
-            if(chip8->inst.N != 0) break;// wrong unimplimented rom opcode
-            if(chip8->V[chip8->inst.X] == chip8->V[chip8->inst.Y]) chip8->PC +=2;
-            break;
-        
-        case 0x06:
-            chip8->V[chip8->inst.X] = chip8->inst.NN;
-            break;
+    switch(event->type){
+        case SDL_QUIT:
+            atomic_store(&emu->state, QUIT);
+            return;
 
-        case 0x07:
-            chip8->V[chip8->inst.X] += chip8->inst.NN;
+        case SDL_WINDOWEVENT:
+            // exposed , restored etc. , whatever was on screen may be gone
+            *redraw = true;
             break;
-
-        case 0x08:{
-            switch (chip8->inst.N) {
-                case 0:
-                    chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y];
+        case SDL_KEYDOWN:
+        {
+            switch(event->key.keysym.sym){
+                
+                case SDLK_ESCAPE: 
+                    atomic_store(&emu->state, QUIT);
+                    return;
+
+                case  SDLK_SPACE:
+                    //spacebar
+                    if(atomic_load(&emu->state) == RUNNING){
+                        atomic_store(&emu->state, PAUSE);
+                        puts("=====PAUSED=====");
+                    } 
+                    else {
+                        atomic_store(&emu->state, RUNNING);
+                        puts("====RUNNNING=====");
+                    }
                     break;
-
-                case 1:
-                    chip8->V[chip8->inst.X] |= chip8->V[chip8->inst.Y];
-                    if (config.current_extension == CHIP8) chip8->V[0xF] = 0; // chip8 only quirk
+                
+                
+                // map qwerty to chip8 keypad
+                case SDLK_1: set_key(emu, event, 0x1, true); break;
+                case SDLK_2: set_key(emu, event, 0x2, true); break;
+                case SDLK_3: set_key(emu, event, 0x3, true); break;
+                case SDLK_4: set_key(emu, event, 0xC, true); break;
+
+                case SDLK_q: set_key(emu, event, 0x4, true); break;
+                case SDLK_w: set_key(emu, event, 0x5, true); break;
+                case SDLK_e: set_key(emu, event, 0x6, true); break;
+                case SDLK_r: set_key(emu, event, 0xD, true); break;
+
+                case SDLK_a: set_key(emu, event, 0x7, true); break;
+                case SDLK_s: set_key(emu, event, 0x8, true); break;
+                case SDLK_d: set_key(emu, event, 0x9, true); break;
+                case SDLK_f: set_key(emu, event, 0xE, true); break;
+
+                case SDLK_z: set_key(emu, event, 0xA, true); break;
+                case SDLK_x: set_key(emu, event, 0x0, true); break;
+                case SDLK_c: set_key(emu, event, 0xB, true); break;
+                case SDLK_v: set_key(emu, event, 0xF, true); break;
+
+
+                case SDLK_TAB:
+                    // fast forward , timers and cpu speed up together
+                    if(atomic_load(&emu->speed) == 1){
+                        atomic_store(&emu->speed, config->turbo_factor);
+                        printf("=====TURBO %ux=====\n", config->turbo_factor);
+                    }
+                    else {
+                        atomic_store(&emu->speed, 1);
+                        puts("=====NORMAL SPEED=====");
+                    }
                     break;
 
-                case 2:
-                    chip8->V[chip8->inst.X] &= chip8->V[chip8->inst.Y];
-                    if (config.current_extension == CHIP8) chip8->V[0xF] = 0;
+                case SDLK_EQUALS:
+                case SDLK_MINUS:
+                    if(event->key.keysym.sym == SDLK_EQUALS) config->turbo_factor *= 2;
+                    else config->turbo_factor /= 2;
+                    if(config->turbo_factor < 2) config->turbo_factor = 2;
+                    if(config->turbo_factor > MAX_TURBO) config->turbo_factor = MAX_TURBO;
+                    if(atomic_load(&emu->speed) != 1) atomic_store(&emu->speed, config->turbo_factor);
+                    printf("turbo factor %ux\n", config->turbo_factor);
                     break;
 
-                case 3:
-                    chip8->V[chip8->inst.X] ^= chip8->V[chip8->inst.Y];
-                    if (config.current_extension == CHIP8) chip8->V[0xF] = 0;
+                case SDLK_BACKSPACE:
+                    // held down , one frame back per frame
+                    if(!event->key.repeat && emu->rewind){
+                        atomic_store(&emu->rewinding, true);
+                        puts("=====REWIND=====");
+                    }
                     break;
 
-                case 4:
-                {
-                    const bool carry = ((uint16_t) (chip8->V[chip8->inst.X] + chip8->V[chip8->inst.Y]) > 255);
-                    chip8->V[chip8->inst.X] += chip8->V[chip8->inst.Y];
-                    chip8->V[0xF] = carry;
-                }
-                    
+                case SDLK_F10:
+                    // profile so far , only does anything in PROFILE=1 builds
+                    PROFILE_REPORT(stdout, "chip8_profile.json");
                     break;
 
-                case 5:
-                {
-                    const bool carry = (chip8->V[chip8->inst.Y] <= chip8->V[chip8->inst.X]);
-                    chip8->V[chip8->inst.X] -= chip8->V[chip8->inst.Y];
-                    chip8->V[0xF] = carry;
-                }
+                case SDLK_UP:
+                    if(config->volume > 7500) config->volume = 8000;
+                    else config->volume +=500;
+                    atomic_store(&emu->volume, config->volume);
                     break;
 
-                case 6:
-                {
-                    bool carry;
-                    
-                    if(config.current_extension == CHIP8){
-                        carry = chip8->V[chip8->inst.Y] & 1;
-                        chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] >> 1;
-                    }
-                    else {
-                        carry = chip8->V[chip8->inst.X] & 1;
-                        chip8->V[chip8->inst.X] >>=1;
-
-                    }
-                    chip8->V[0xF] = carry;
-                }
+                case SDLK_DOWN:
+                    if(config->volume < 500 )config->volume = 0;
+                    else config->volume -=500; 
+                    atomic_store(&emu->volume, config->volume);
                     break;
 
-                case 7:
-                {
-                    const bool carry = (chip8->V[chip8->inst.X] <= chip8->V[chip8->inst.Y]);
-                    chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] - chip8->V[chip8->inst.X];
-                    chip8->V[0xF] = carry;
-                }
-                    break;
-                
-                case 0xE:
-                {
-                    bool carry;
-                    if(config.current_extension == CHIP8){
-                        carry = (chip8->V[chip8->inst.Y] & 0x80) >> 7;
-                        chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] << 1;
-                    }
-                    else {
-                        carry = (chip8->V[chip8->inst.Y] & 0x80) >> 7;
-                        chip8->V[chip8->inst.X] <<=1;
-                    }
-                    chip8->V[0xF] = carry;
-                }
-                    break;
-
-
                 default:
                     break;
-                
             }
+            break;
+        }
             
+        case SDL_KEYUP:
+        {
+            switch (event->key.keysym.sym) {
+                case SDLK_1: set_key(emu, event, 0x1, false); break;
+                case SDLK_2: set_key(emu, event, 0x2, false); break;
+                case SDLK_3: set_key(emu, event, 0x3, false); break;
+                case SDLK_4: set_key(emu, event, 0xC, false); break;
+                case SDLK_q: set_key(emu, event, 0x4, false); break;
+                case SDLK_w: set_key(emu, event, 0x5, false); break;
+                case SDLK_e: set_key(emu, event, 0x6, false); break;
+                case SDLK_r: set_key(emu, event, 0xD, false); break;
+                case SDLK_a: set_key(emu, event, 0x7, false); break;
+                case SDLK_s: set_key(emu, event, 0x8, false); break;
+                case SDLK_d: set_key(emu, event, 0x9, false); break;
+                case SDLK_f: set_key(emu, event, 0xE, false); break;
+                case SDLK_z: set_key(emu, event, 0xA, false); break;
+                case SDLK_x: set_key(emu, event, 0x0, false); break;
+                case SDLK_c: set_key(emu, event, 0xB, false); break;
+                case SDLK_v: set_key(emu, event, 0xF, false); break;
+                case SDLK_BACKSPACE: atomic_store(&emu->rewinding, false); break;
+            }
+            break;
+
         }
         break;
+        
+        
+        default:
+            break;   
+    }
+}
 
-        case 0x09:
-            if(chip8->V[chip8->inst.X] != chip8->V[chip8->inst.Y])
-            chip8->PC +=2;
-            break;
 
-        case 0x0A:
-            chip8->I = chip8->inst.NNN;
-            break;
+// performance counter ticks as audio samples , without overflowing for long runs
+static uint64_t sample_time(uint64_t ticks, uint64_t freq, uint32_t sample_rate){
+    return ticks / freq * sample_rate + ticks % freq * sample_rate / freq;
+}
 
-        case 0x0B:
-            chip8->PC = chip8->V[0] + chip8->inst.NNN;
-            break;
-        
-        case 0x0C:
-            chip8->V[chip8->inst.X] = (rand() % 256) & chip8->inst.NN;
-            break;
-  
-        case 0x0D:
-        {
-            uint8_t X = chip8->V[chip8->inst.X] % config.window_width;
-            uint8_t Y = chip8->V[chip8->inst.Y] % config.window_height; // Fix: Use inst.Y instead of inst.X
-            chip8->V[0xF] = 0;
-            uint8_t original_X = X;
+// keypad as a movie mask , bit n set while key n is down
+static uint16_t keypad_mask(const chip8_t * chip8){
+    uint16_t keys = 0;
+    for(uint8_t i = 0; i < 16; i++) keys |= chip8->keypads[i] << i;
+    return keys;
+}
 
-            for(uint8_t i = 0; i < chip8->inst.N; i++) {
-                uint8_t sprite_data = chip8->ram[chip8->I + i];
-                X = original_X;
+// the program looked at keys since the last call , times the presses it saw first
+static void note_key_reads(emulator_t * emu, chip8_t * chip8){
+    if(chip8->keys_read & input_unread(emu->input))
+        input_read(emu->input, chip8->keys_read, SDL_GetPerformanceCounter());
+    chip8->keys_read = 0;
+}
 
-                for(int j = 7; j >= 0; j--) {
-                    bool *pixel = &chip8->display[Y * config.window_width + X];
-                    bool sprite_bit = (sprite_data & (1 << j));
+// runs the machine at its own pace , a slow present on the SDL thread can't
+// hold the clock or the timers back.
+//
+// emulated time is kept in an accumulator of performance counter ticks (times
+// 60 so a timer tick is exactly freq units). every tick runs its share of
+// instructions in KEY_SLICES slices , each as soon as it is due , and then the
+// timers , so nothing drifts however long SDL_Delay really sleeps , and the
+// turbo factor speeds both up together. key changes are handed over before
+// each slice up to the time it was due , a press waits a slice at most
+static int emulation_thread(void * data){
+    emulator_t * emu = data;
+    chip8_t * chip8 = emu->chip8;
+    const config_t * config = emu->config;
+    const interpreter_t * interpreter = select_interpreter(config->current_extension);
+    const bool uncapped = config->inst_per_second == 0;
+    const bool tracing = recorder_tracing(emu->recorder);
+    const uint64_t freq = SDL_GetPerformanceFrequency();
+
+    uint64_t last = SDL_GetPerformanceCounter();
+    uint64_t time_acc = 0; // emulated time owed , counter ticks * 60
+    uint32_t inst_acc = 0; // instructions owed , * 60 , see frame_budget
+    uint32_t frame = 0;    // timer ticks run , the frame numbers of the movie
+    uint32_t slice = 0;    // slices of the current frame run
+    uint32_t frame_work = 0; // instructions , or cycles , the current frame has to run
+    const uint64_t start = last;
+    voice_t voice;
+    fault_t reported = FAULT_NONE; // last fault logged
+    bool exited = false;           // 00FD logged , until a rewind takes it back
+
+    // stats for -d
+    uint64_t stats_start = last, stats_instructions = 0, stats_ticks = 0;
+    double stats_expected_ticks = 0;
 
-                    if(sprite_bit && *pixel) {
-                        chip8->V[0xF] = 1; // Set collision flag
-                    }
+    state_t state;
 
-                    *pixel ^= sprite_bit; // XOR pixel with sprite bit
+    while ((state = atomic_load(&emu->state)) != QUIT) {
+        if(state == PAUSE){
+            // keys change while paused , presses aren't timed through it
+            input_deliver(emu->input, UINT64_MAX, chip8->keypads);
+            input_forget(emu->input);
+            machine_voice(chip8, atomic_load(&emu->volume), false, &voice);
+            audio_set_voice(emu->sdl->audio, sample_time(last - start, freq, config->audio_sample_rate), &voice);
+            SDL_Delay(16); // the SDL thread blocks on events , this just naps
+            last = SDL_GetPerformanceCounter(); // paused time isn't owed
+            continue;
+        }
 
-                    if(++X >= config.window_width) break;
+        const uint64_t now = SDL_GetPerformanceCounter();
+        const uint32_t speed = atomic_load(&emu->speed);
+        uint64_t elapsed = now - last;
+        last = now;
+        stats_expected_ticks += (double) elapsed * speed * 60 / freq;
+
+        // after a long stall don't try to run seconds of backlog at once ,
+        // the lost time shows up as drift
+        if(elapsed > freq / 4) elapsed = freq / 4;
+        time_acc += elapsed * 60 * speed;
+
+        const bool rewinding = atomic_load(&emu->rewinding);
+
+        const uint16_t volume = atomic_load(&emu->volume);
+        bool frame_done = false;
+
+        for(;;){
+            // a rewound frame goes back whole , a slice is due at its share of the tick
+            const uint64_t slice_due = rewinding && slice == 0 ? freq : freq * (slice + 1) / KEY_SLICES;
+            if(time_acc < slice_due) break;
+
+            if(rewinding && slice == 0){
+                time_acc -= freq;
+                frame_done = true;
+
+                // when this tick was due , its sound changes land on that sample
+                const uint64_t due = sample_time(now - time_acc / (60 * speed) - start, freq, config->audio_sample_rate);
+
+                // the frames come back at the speed they were played , the
+                // timers are in the snapshots so they aren't ticked. the clock
+                // remainder and the movie go back with them
+                if(rewind_step(emu->rewind, chip8) && frame){
+                    frame--;
+                    inst_acc = (uint64_t) frame * config->inst_per_second % 60;
+                    if(emu->movie) movie_truncate(emu->movie, frame);
                 }
-
-                if(++Y >= config.window_height) break;
+                input_deliver(emu->input, now, chip8->keypads);
+                input_forget(emu->input);
+                machine_voice(chip8, volume, false, &voice);
+                audio_set_voice(emu->sdl->audio, due, &voice);
+                if(emu->recorder) recorder_frame(emu->recorder, chip8);
+                continue;
             }
-        }
-        break;
 
-        case 0x0E:
-            if(chip8->inst.NN == 0x9E) {
-                if (chip8->keypads[chip8->V[chip8->inst.X]])
-                chip8->PC +=2;
-            } 
-            else if (chip8->inst.NN == 0xA1) {
-                if (!chip8->keypads[chip8->V[chip8->inst.X]])
-                chip8->PC +=2;
-            }
-            break;
+            // the changes that happened by the time this slice was due. with a
+            // movie keys only change between frames , so it has everything the
+            // program saw
+            if(!emu->movie || slice == 0)
+                input_deliver(emu->input, now - (time_acc - slice_due) / (60 * speed), chip8->keypads);
 
-        case 0x0F:
-            {
-                switch(chip8->inst.NN){
-                    case 0x0A: {
-                        static bool any_key_pressed = false;
-                        static uint8_t key = 0xFF;
-
-                        for (uint8_t i = 0; key == 0xFF && i < sizeof chip8->keypads; i++) 
-                            if (chip8->keypads[i]) {
-                                key = i;    
-                                any_key_pressed = true;
-                                break;
-                            }
-
-                        if (!any_key_pressed) chip8->PC -= 2; 
-                        else {
-                            if (chip8->keypads[key])     
-                                chip8->PC -= 2;
-                            else {
-                                chip8->V[chip8->inst.X] = key;     
-                                key = 0xFF;                       
-                                any_key_pressed = false;          
-                            }
-                        }
-                        break;
-                    }
-                    case 0x1E:
-                        chip8->I += chip8->V[chip8->inst.X];
-                        break;
-                    
-                    case 0x07:
-                        chip8->V[chip8->inst.X] = chip8->delay_timer;
-                        break;
-
-                    
-                    case 0x15:
-                        chip8->delay_timer = chip8->V[chip8->inst.X];
-                        break;
-
-                    case 0x18:
-                        chip8->sound_timer = chip8->V[chip8->inst.X];
-                        break;
-
-                    case 0x29:
-                        chip8->I = chip8->V[chip8->inst.X] *5;
-                        break;
-
-                    case 0x33:
-                    {
-                        uint8_t bcd = chip8->V[chip8->inst.X];
-                        chip8->ram[chip8->I+2] = bcd % 10; bcd /=10;
-                        chip8->ram[chip8->I+1] = bcd % 10; bcd /=10;
-                        chip8->ram[chip8->I] = bcd;
-                        break;
-                    }
-                    case 0x55:
-                        for(uint8_t i =0 ; i<= chip8->inst.X; i++){
-                            if(config.current_extension == CHIP8){
-                                chip8->ram[chip8->I++] = chip8->V[i]; 
-                            }
-                            else chip8->ram[chip8->I + i] = chip8->V[i]; 
-                        }
-                        break;
-
-                    case 0x65:
-                        for(uint8_t i =0 ; i<= chip8->inst.X; i++){
-                            if(config.current_extension == CHIP8) chip8->V[i] = chip8->ram[chip8->I ++];
-                            else  chip8->V[i] = chip8->ram[chip8->I + i] ; 
-
-                        }
-
-                        break;
-                        
-                    default:
-                        break;
+            if(slice == 0){
+                if(emu->movie && !movie_record(emu->movie, frame, keypad_mask(chip8))){
+                    SDL_Log("Out of memory for the movie , recording stopped\n");
+                    emu->movie = NULL;
                 }
+                frame_work = uncapped ? 0 :
+                             config->cycles_per_frame ? config->cycles_per_frame :
+                             frame_budget(config->inst_per_second, &inst_acc);
             }
-                    
 
-        default:{
-            break; // unimplimented opcode
+            // the slices split the frame's work , a slice of the cycle schedule
+            // after a display wait runs nothing
+            const uint32_t work = (uint64_t) frame_work * (slice + 1) / KEY_SLICES -
+                                  (uint64_t) frame_work * slice / KEY_SLICES;
+            if(work){
+                if(config->cycles_per_frame) stats_instructions += interpreter->run_cycles(chip8, config, work);
+                // a trace wants every instruction , idle loops included
+                else if(tracing) stats_instructions += recorder_run(emu->recorder, interpreter, chip8, config, work);
+                else stats_instructions += interpreter->run(chip8, config, work);
+            }
+            note_key_reads(emu, chip8);
+
+            if(++slice < KEY_SLICES) continue;
+            slice = 0;
+            time_acc -= freq;
+            frame_done = true;
+
+            const uint64_t due = sample_time(now - time_acc / (60 * speed) - start, freq, config->audio_sample_rate);
+
+            // update delay and sound timers , tone plays while sound timer > 0.
+            // a full queue only happens with no audio thread running , the
+            // change goes again next tick
+            machine_voice(chip8, volume, update_timers(chip8), &voice);
+            audio_set_voice(emu->sdl->audio, due, &voice);
+            stats_ticks++;
+
+            // the video gets every tick , whether it was drawn to or not
+            if(emu->recorder) recorder_frame(emu->recorder, chip8);
+            if(emu->rewind) rewind_record(emu->rewind, chip8);
+            frame++;
         }
-    }
 
-}
+        if(chip8->fault != reported){
+            reported = chip8->fault;
+            if(reported) SDL_Log("Program stopped , %s at %03X\n", fault_name(reported), chip8->PC);
+        }
+        // a clean exit halts the same way , the window stays up so it can be rewound
+        if((chip8->state == QUIT && !chip8->fault) != exited){
+            exited = !exited;
+            if(exited) SDL_Log("Program exited (00FD at %03X) , Esc closes the window%s\n", chip8->PC,
+                               emu->rewind ? " , Backspace rewinds" : "");
+        }
 
-void update_timers(sdl_t sdl,chip8_t *chip8){
-    if(chip8->delay_timer > 0) chip8->delay_timer--;
-    if(chip8->sound_timer > 0){
-        chip8->sound_timer--;
-        SDL_PauseAudioDevice(sdl.dev,0);
-    }
-    else {
-        SDL_PauseAudioDevice(sdl.dev,1);
-        // dont play sound
+        // finished frame , hand it over only when something was drawn. half a
+        // frame is never shown , uncapped runs don't keep to frames
+        if((frame_done || uncapped) && take_dirty_rows(chip8)){
+            frame_t * back = &emu->display.frames[emu->display.back];
+            memcpy(back->display, chip8->display, sizeof(chip8->display));
+            memcpy(back->display2, chip8->display2, sizeof(chip8->display2));
+            back->hires = chip8->hires;
+            back->pressed = input_take_shown(emu->input);
+            // a frame replaced before it got on screen passes its press on to the next
+            if(publish_frame(&emu->display)) input_unshown(emu->input, emu->display.frames[emu->display.back].pressed);
+
+            SDL_Event event = { .type = emu->frame_event };
+            SDL_PushEvent(&event);
+        }
+
+        if(uncapped && !rewinding){
+            // no clock , just a slice between checks of the timers and input ,
+            // unless the program is only waiting , then sleep like capped mode
+            stats_instructions += tracing ? recorder_run(emu->recorder, interpreter, chip8, config, UNCAPPED_SLICE)
+                                          : interpreter->run(chip8, config, UNCAPPED_SLICE);
+            note_key_reads(emu, chip8);
+        }
+        if(!uncapped || rewinding || chip8->idle_cycle){
+            // sleep until the next slice is due
+            const uint64_t next = rewinding && slice == 0 ? freq : freq * (slice + 1) / KEY_SLICES;
+            const uint64_t wait = (next - time_acc) / (60 * speed);
+            const uint32_t wait_ms = wait * 1000 / freq;
+            if(wait_ms) SDL_Delay(wait_ms);
+        }
+
+        if(config->show_stats && now - stats_start >= freq){
+            const double seconds = (double) (now - stats_start) / freq;
+            printf("ips %.0f  speed %ux  timer ticks %llu  drift %+.2f ticks\n",
+                   stats_instructions / seconds, speed, (unsigned long long) stats_ticks,
+                   stats_ticks - stats_expected_ticks);
+            stats_start = now;
+            stats_instructions = 0;
+            stats_ticks = 0;
+            stats_expected_ticks = 0;
+        }
     }
-        
+    return 0;
 }
 
-
 int main(int argc, char ** argv){
 
     if(argc < 2){
-        fprintf(stderr,"Usage %s <rom_name>\n",argv[0]);
+        fprintf(stderr,"Usage %s [-c inst_per_second (0 = uncapped)] [-V] [-t turbo_factor] [-d] [-e chip8|schip|xochip] [-r rewind_mb] [-s seed] [-m movie] [-p c0,c1,c2,c3] [-R video.y4m|gif|raw] [-T trace] <rom_name>\n",argv[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -707,39 +741,115 @@ int main(int argc, char ** argv){
 
     // initialize the machine
     chip8_t chip8 = {0};
-    char * rom_name = argv[1];
-
-    if(!init_chip8(&chip8,rom_name)) exit(EXIT_FAILURE);
-    // initial screen clear 
-    clearScreen(&sdl, &config);
-    srand(time(NULL));
-
+    char * rom_name = argv[argc - 1];
 
-    while (chip8.state != QUIT) {
+    // xo-chip programs get the whole 64 KB
+    static uint8_t xo_ram[XO_RAM_SIZE];
+    if(config.current_extension == XOCHIP) attach_xo_ram(&chip8, xo_ram);
 
+    if(!init_chip8(&chip8,rom_name)) exit(EXIT_FAILURE);
 
-        handle_input(&chip8,&config);
-        if(chip8.state == PAUSE) continue;
-
-        uint64_t before_frame = SDL_GetPerformanceCounter();
+    static decode_cache_t decode_cache; // decoded opcodes , dropped on ram writes
+    attach_decode_cache(&chip8,&decode_cache);
+    const uint32_t seed = config.seed ? config.seed : (uint32_t) time(NULL);
+    seed_chip8(&chip8, seed);
 
-        for(uint32_t i =0  ; i<config.inst_per_second / 60;i++)  emulate_instruction(&chip8,config);
- 
+    // initial screen clear 
+    clearScreen(&sdl, &config);
 
-        uint64_t after_frame = SDL_GetPerformanceCounter();
+    emulator_t emu = {
+        .chip8 = &chip8,
+        .config = &config,
+        .sdl = &sdl,
+        .frame_event = SDL_RegisterEvents(1),
+    };
+    atomic_init(&emu.state, RUNNING);
+    atomic_init(&emu.speed, 1);
+    atomic_init(&emu.rewinding, false);
+    atomic_init(&emu.volume, config.volume);
+    static movie_t movie;
+    if(config.movie_path){
+        movie_init(&movie, seed, config.inst_per_second, config.current_extension);
+        movie.cycles_per_frame = config.cycles_per_frame;
+        movie.display_wait = config.display_wait;
+        emu.movie = &movie;
+    }
+    if(config.rewind_bytes){
+        emu.rewind = rewind_create(config.rewind_bytes, REWIND_DEFAULT_FRAMES, ram_size(&chip8));
+        if(!emu.rewind) SDL_Log("Could not allocate the rewind history , rewind is off\n");
+    }
+    if(config.video_path || config.trace_path){
+        emu.recorder = recorder_create(config.video_path, config.trace_path, config.palette, 0, 0);
+        if(!emu.recorder){
+            cleanupSDL(&sdl);
+            exit(EXIT_FAILURE);
+        }
+    }
+    emu.input = input_create(SDL_GetPerformanceFrequency());
+    if(!emu.input){
+        SDL_Log("Out of memory for the key queue\n");
+        cleanupSDL(&sdl);
+        exit(EXIT_FAILURE);
+    }
+    init_triple_buffer(&emu.display);
 
-        const double time_elapsed = (double)((after_frame - before_frame) * 1000) / SDL_GetPerformanceFrequency(); 
+    SDL_Thread * emulation = SDL_CreateThread(emulation_thread, "emulation", &emu);
+    if(!emulation){
+        SDL_Log("SDL_CreateThread Error : %s",SDL_GetError());
+        cleanupSDL(&sdl);
+        exit(EXIT_FAILURE);
+    }
 
-        //clearScreen(&sdl, &config); // Optional — keep or remove depending on rendering logic
-        SDL_Delay(16.67f > time_elapsed ? 16.67 - time_elapsed : 0); // ~60 fps
-        // Emulate chip8 instructions here
+    // this thread only does input and presentation , sleeping until either
+    // an event or a new frame shows up
+    frame_t shown = {0}; // what is on screen now
+    bool redraw = true;
 
-        updateScreen(&sdl,&config,&chip8);
+    while (atomic_load(&emu.state) != QUIT) {
+        SDL_Event event;
+        if(SDL_WaitEvent(&event)){
+            do handle_input(&emu, &event, &redraw);
+            while(SDL_PollEvent(&event));
+        }
 
-        update_timers(sdl,&chip8); // update delay and sound timers
-        
+        const bool new_frame = take_frame(&emu.display);
+        if(!new_frame && !redraw) continue;
+
+        const frame_t * frame = &emu.display.frames[emu.display.front];
+        // a new resolution redraws all , the texture holds the old one's pixels
+        const uint32_t height = frame->hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+        uint64_t dirty_rows = redraw || frame->hires != shown.hires ? ~0ull >> (64 - height) : 0;
+        for(uint32_t y = 0; y < height; y++)
+            if(memcmp(frame->display[y], shown.display[y], sizeof(shown.display[y])) != 0 ||
+               memcmp(frame->display2[y], shown.display2[y], sizeof(shown.display2[y])) != 0) dirty_rows |= 1ull << y;
+
+        // frames in between may have been skipped , so diff against what is shown
+        if(dirty_rows){
+            updateScreen(&sdl,&config,frame,dirty_rows);
+            shown = *frame;
+        }
+        if(new_frame) input_presented(emu.input, frame->pressed, SDL_GetPerformanceCounter());
+        redraw = false;
     }
 
+    SDL_WaitThread(emulation, NULL);
+    if(config.show_stats) input_report(emu.input, stdout);
+    input_destroy(emu.input);
+    rewind_destroy(emu.rewind);
+    if(emu.recorder){
+        record_stats_t stats;
+        recorder_stats(emu.recorder, &stats);
+        if(config.show_stats)
+            printf("recorded %llu frames (%llu dropped) , %llu trace records (%llu dropped)\n",
+                   (unsigned long long) stats.frames, (unsigned long long) stats.frames_dropped,
+                   (unsigned long long) stats.trace, (unsigned long long) stats.trace_dropped);
+        recorder_destroy(emu.recorder);
+    }
+    if(config.movie_path){
+        if(movie_save(&movie, config.movie_path)) printf("movie of %u frames saved to %s\n", movie.frames, config.movie_path);
+        movie_free(&movie);
+    }
+    PROFILE_REPORT(stdout, "chip8_profile.json");
 
     //final cleanup
     cleanupSDL(&sdl);
@@ -0,0 +1,170 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "chip8_audio.h"
+
+#define WAVE_BITS 11
+#define WAVE_SIZE (1u << WAVE_BITS)
+#define QUEUE_SIZE 256       // voice changes in flight , a power of two
+#define RAMP_SAMPLES 64      // envelope attack and release , about 1.5 ms
+#define PATTERN_RATE 4000.0  // xo-chip pattern bits per second at pitch 64
+#define PATTERN_BITS 128
+#define TAU 6.28318530718f
+
+typedef struct{
+    uint64_t at;
+    voice_t voice;
+} audio_event_t;
+
+struct audio{
+    // the queue , tail is only written by the producer and head by the
+    // consumer , each on its own cache line
+    _Alignas(64) atomic_uint tail;
+    _Alignas(64) atomic_uint head;
+    audio_event_t events[QUEUE_SIZE];
+
+    // producer only
+    _Alignas(64) voice_t posted; // last voice queued
+    bool any_posted;
+
+    // consumer only
+    int16_t wave[WAVE_SIZE];           // one period of the square , peak 32767
+    uint32_t square_step;              // phase increment per sample of the square
+    uint32_t pattern_steps[256];       // phase increment per sample for each pitch
+    uint32_t latency;
+    voice_t voice;                     // playing now
+    uint32_t phase;                    // position in the wave or pattern , wraps
+    int32_t level;                     // envelope , 0 .. voice.volume
+    int32_t target;
+    int32_t ramp;                      // level change per sample until target
+    uint64_t clock;                    // samples rendered
+    int64_t offset;                    // event time + offset = sample it plays on
+    bool synced;
+};
+
+void machine_voice(const chip8_t * chip8, uint16_t volume, bool gate, voice_t * voice){
+    memcpy(voice->pattern, chip8->audio_pattern, sizeof(voice->pattern));
+    voice->volume = volume;
+    voice->pitch = chip8->pitch;
+    voice->use_pattern = chip8->pattern_loaded;
+    voice->gate = gate;
+}
+
+static bool same_voice(const voice_t * a, const voice_t * b){
+    return a->volume == b->volume && a->pitch == b->pitch && a->use_pattern == b->use_pattern &&
+           a->gate == b->gate && memcmp(a->pattern, b->pattern, sizeof(a->pattern)) == 0;
+}
+
+// odd harmonics below nyquist , sigma weighted so the edges ring less , then
+// scaled to a 32767 peak
+static void build_square(int16_t * wave, uint32_t sample_rate, uint32_t freq){
+    float sum[WAVE_SIZE];
+    const uint32_t harmonics = freq ? sample_rate / 2 / freq : 1;
+    float peak = 0;
+
+    for(uint32_t i = 0; i < WAVE_SIZE; i++){
+        float s = 0;
+        for(uint32_t k = 1; k <= harmonics; k += 2){
+            const float x = TAU / 2 * k / (harmonics + 1);
+            s += sinf(TAU * k * i / WAVE_SIZE) / k * sinf(x) / x;
+        }
+        sum[i] = s;
+        if(fabsf(s) > peak) peak = fabsf(s);
+    }
+    for(uint32_t i = 0; i < WAVE_SIZE; i++) wave[i] = lrintf(sum[i] / peak * 32767);
+}
+
+audio_t * audio_create(uint32_t sample_rate, uint32_t square_freq, uint32_t latency){
+    audio_t * audio = aligned_alloc(64, (sizeof(*audio) + 63) & ~(size_t) 63);
+    if(!audio) return NULL;
+    memset(audio, 0, sizeof(*audio));
+    atomic_init(&audio->tail, 0);
+    atomic_init(&audio->head, 0);
+
+    build_square(audio->wave, sample_rate, square_freq);
+    audio->square_step = (uint32_t) ((double) square_freq * 4294967296.0 / sample_rate);
+    for(uint32_t pitch = 0; pitch < 256; pitch++){
+        const double bits_per_second = PATTERN_RATE * pow(2, (pitch - 64.0) / 48);
+        audio->pattern_steps[pitch] = (uint32_t) (bits_per_second / PATTERN_BITS * 4294967296.0 / sample_rate);
+    }
+    audio->latency = latency;
+    return audio;
+}
+
+void audio_destroy(audio_t * audio){
+    free(audio);
+}
+
+bool audio_set_voice(audio_t * audio, uint64_t at, const voice_t * voice){
+    if(audio->any_posted && same_voice(voice, &audio->posted)) return true;
+
+    const uint32_t tail = atomic_load_explicit(&audio->tail, memory_order_relaxed);
+    if(tail - atomic_load_explicit(&audio->head, memory_order_acquire) == QUEUE_SIZE) return false;
+
+    audio->events[tail & (QUEUE_SIZE - 1)] = (audio_event_t){ .at = at, .voice = *voice };
+    atomic_store_explicit(&audio->tail, tail + 1, memory_order_release);
+    audio->posted = *voice;
+    audio->any_posted = true;
+    return true;
+}
+
+static void play_voice(audio_t * audio, const voice_t * voice){
+    audio->voice = *voice;
+    audio->target = voice->gate ? (voice->volume > 32767 ? 32767 : voice->volume) : 0;
+    audio->ramp = (abs(audio->target - audio->level) + RAMP_SAMPLES - 1) / RAMP_SAMPLES;
+}
+
+void audio_render(audio_t * audio, int16_t * out, uint32_t count){
+    const uint32_t tail = atomic_load_explicit(&audio->tail, memory_order_acquire);
+    uint32_t head = atomic_load_explicit(&audio->head, memory_order_relaxed);
+
+    // further off than this the clocks went apart (a stall , a pause) , the
+    // next change then plays latency samples from now
+    const int64_t window = 4 * (int64_t) audio->latency;
+
+    for(uint32_t i = 0; i < count; i++, audio->clock++){
+        while(head != tail){
+            const audio_event_t * event = &audio->events[head & (QUEUE_SIZE - 1)];
+            int64_t when = (int64_t) event->at + audio->offset;
+            if(!audio->synced || when < (int64_t) audio->clock - window || when > (int64_t) audio->clock + window){
+                audio->offset = (int64_t) audio->clock + audio->latency - (int64_t) event->at;
+                audio->synced = true;
+                when = audio->clock + audio->latency;
+            }
+            if(when > (int64_t) audio->clock) break;
+            play_voice(audio, &event->voice);
+            head++;
+        }
+
+        if(audio->level != audio->target){
+            if(audio->level < audio->target){
+                audio->level += audio->ramp;
+                if(audio->level > audio->target) audio->level = audio->target;
+            }
+            else {
+                audio->level -= audio->ramp;
+                if(audio->level < audio->target) audio->level = audio->target;
+            }
+        }
+        if(!audio->level){
+            out[i] = 0;
+            continue;
+        }
+
+        int32_t sample;
+        if(audio->voice.use_pattern){
+            const uint32_t bit = audio->phase >> 25; // 0 .. PATTERN_BITS - 1
+            sample = (audio->voice.pattern[bit >> 3] >> (7 - (bit & 7))) & 1 ? 32767 : -32767;
+            audio->phase += audio->pattern_steps[audio->voice.pitch];
+        }
+        else {
+            sample = audio->wave[audio->phase >> (32 - WAVE_BITS)];
+            audio->phase += audio->square_step;
+        }
+        out[i] = (sample * audio->level) >> 15;
+    }
+
+    atomic_store_explicit(&audio->head, head, memory_order_release);
+}
@@ -0,0 +1,49 @@
+#ifndef CHIP8_AUDIO_H
+#define CHIP8_AUDIO_H
+
+// sound for the front end , no SDL in here
+//
+// the emulation thread says what should be playing (voice_t) and when , the
+// audio thread renders it. the two only meet in a lock free single producer ,
+// single consumer queue of timestamped voice changes , so neither side ever
+// waits and nothing the audio thread reads is changed under it.
+//
+// the classic tone is one period of a band limited square in a wavetable ,
+// stepped through by a 32 bit phase accumulator , so a sample costs a shift
+// and a multiply. xo-chip patterns play their 128 bits the same way. the
+// sound timer opens and closes a short linear envelope on the sample the
+// change is due , the device itself never stops , so no clicks and no calls
+// into SDL every frame
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "chip8_core.h"
+
+typedef struct{
+    uint8_t pattern[16]; // xo-chip samples , bit 7 of byte 0 first
+    uint16_t volume;     // peak amplitude of the 16 bit output
+    uint8_t pitch;       // xo-chip pitch , see chip8_t
+    bool use_pattern;    // play pattern instead of the square
+    bool gate;           // sound timer running
+} voice_t;
+
+typedef struct audio audio_t;
+
+// voice_t of the machine at volume , gate is whether the sound timer runs
+void machine_voice(const chip8_t * chip8, uint16_t volume, bool gate, voice_t * voice);
+
+// square_freq is the classic tone. changes land latency samples after their
+// time , enough to cover one device buffer. NULL when out of memory
+audio_t * audio_create(uint32_t sample_rate, uint32_t square_freq, uint32_t latency);
+void audio_destroy(audio_t * audio);
+
+// producer : voice from sample at on (samples of real time since any fixed
+// start , counting up). only changes are queued , false if the queue was full
+// and the change has to be tried again
+bool audio_set_voice(audio_t * audio, uint64_t at, const voice_t * voice);
+
+// consumer : the next count samples of mono 16 bit output
+void audio_render(audio_t * audio, int16_t * out, uint32_t count);
+
+#endif
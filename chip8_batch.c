@@ -0,0 +1,419 @@
+// batch runner , many independent machines over one or more roms spread across
+// every core. each instance runs a fixed number of frames with scripted (or
+// seeded random) input and reports its final display hash , registers and
+// instruction count.
+//
+// instances are only materialised while a worker runs them , so the count is
+// bounded by the small result records , not by chip8_t. work is handed out
+// as index ranges , one per worker , and an idle worker steals the top half
+// of the busiest looking range
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "chip8_core.h"
+#include "chip8_lanes.h"
+#include "chip8_movie.h"
+
+#define MAX_ROMS 64
+
+typedef struct{
+    uint64_t instructions;
+    uint32_t display_hash;
+    uint16_t PC;
+    uint16_t I;
+    uint8_t V[16];
+    uint8_t stack_depth;
+    state_t state;
+} result_t;
+
+// the part of the instance range a worker still owns , [next , end)
+typedef struct{
+    pthread_mutex_t lock;
+    uint64_t next;
+    uint64_t end;
+} range_t;
+
+typedef struct batch batch_t;
+
+typedef struct{
+    batch_t * batch;
+    pthread_t thread;
+    range_t range;
+    decode_cache_t * decode_cache;
+    lanes_t * lanes; // -l only
+    uint8_t * xo_ram; // xochip only , the 64 KB of the instance being run
+    uint64_t steals;
+    uint64_t vector_steps;
+    uint64_t scalar_steps;
+} worker_t;
+
+struct batch{
+    config_t config;
+    uint32_t frames;
+    uint32_t per_rom;   // instances per rom
+    uint32_t rom_count;
+    chip8_t roms[MAX_ROMS]; // loaded once , instances copy ram out of these (64 KB for xochip)
+    movie_t script;     // -k , only its key changes are used
+    bool random_input;
+    uint32_t seed;
+    bool lockstep;      // -l , instances run LANE_WIDTH at a time in chip8_lanes
+    uint32_t chunks;    // work units per rom , 1 instance each or LANE_WIDTH with -l
+    result_t * results;
+    worker_t * workers;
+    uint32_t worker_count;
+};
+
+static void usage(const char * prog){
+    fprintf(stderr,
+        "Usage %s [options] <rom_name> [rom_name ...]\n"
+        "  -n N   instances per rom (default 1)\n"
+        "  -f N   frames per instance (default 600)\n"
+        "  -c N   instructions per second of the emulated clock (default 700)\n"
+        "  -e S   quirks of chip8 , schip or xochip (default chip8)\n"
+        "  -j N   worker threads (default one per core)\n"
+        "  -k F   input script , an input movie or lines of \"<frame> <hex key mask>\"\n"
+        "  -r     random input instead , seeded per instance\n"
+        "  -s N   base seed for -r and CXNN , instance i gets its own seed from it (default 1)\n"
+        "  -l     step %d instances of a rom at a time in lockstep (vector lanes)\n"
+        "  -o F   write per instance results to F (default stdout)\n"
+        "  -q     no per instance results , only the summary\n",
+        prog, LANE_WIDTH);
+}
+
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// where an instance's keys come from , a script or its own random stream
+typedef struct{
+    uint32_t rng;
+    uint32_t next_event;
+    uint16_t keys;
+} input_t;
+
+// the same instance gets the same seed whichever way it's run
+static uint32_t instance_seed(const batch_t * batch, uint64_t index){
+    return batch->seed + (uint32_t) index * 2654435761u;
+}
+
+static void init_input(const batch_t * batch, uint64_t index, input_t * input){
+    input->rng = instance_seed(batch, index) ^ 0x5BD1E995u; // not the machine's CXNN stream
+    if(!input->rng) input->rng = 1;
+    input->next_event = 0;
+    input->keys = 0;
+}
+
+static uint16_t next_keys(const batch_t * batch, input_t * input, uint32_t frame){
+    if(batch->random_input){
+        // hold keys for a while , a fresh random mask every 8 frames or so
+        if((xorshift32(&input->rng) & 7) == 0) input->keys = xorshift32(&input->rng) & xorshift32(&input->rng);
+    }
+    else input->keys = movie_keys(&batch->script, frame, &input->next_event);
+    return input->keys;
+}
+
+static void store_result(const batch_t * batch, uint64_t index, const chip8_t * chip8, uint64_t instructions){
+    result_t * result = &batch->results[index];
+    result->instructions = instructions;
+    result->display_hash = display_hash(chip8);
+    result->PC = chip8->PC;
+    result->I = chip8->I;
+    memcpy(result->V, chip8->V, sizeof(result->V));
+    result->stack_depth = chip8->SP;
+    result->state = chip8->state;
+}
+
+static void run_instance(const batch_t * batch, worker_t * worker, uint64_t index, chip8_t * chip8){
+    const chip8_t * rom = &batch->roms[index / batch->per_rom];
+
+    memset(chip8, 0, sizeof(*chip8));
+    attach_xo_ram(chip8, worker->xo_ram);
+    init_chip8_image(chip8, chip8_ram(rom) + 0x200, ram_size(rom) - 0x200, rom->rom_name);
+    attach_decode_cache(chip8, worker->decode_cache);
+    seed_chip8(chip8, instance_seed(batch, index));
+
+    const interpreter_t * interpreter = select_interpreter(batch->config.current_extension);
+    uint32_t acc = 0; // frame_budget's , frames get the same share as in chip8-run
+    uint64_t instructions = 0;
+    input_t input;
+    init_input(batch, index, &input);
+
+    for(uint32_t frame = 0; frame < batch->frames && chip8->state != QUIT; frame++){
+        const uint16_t keys = next_keys(batch, &input, frame);
+        for(uint8_t i = 0; i < 16; i++) chip8->keypads[i] = (keys >> i) & 1;
+
+        instructions += run_frame(interpreter, chip8, &batch->config, &acc);
+        update_timers(chip8);
+    }
+
+    store_result(batch, index, chip8, instructions);
+}
+
+// up to LANE_WIDTH instances of one rom side by side. lanes run every
+// instruction , there's no idle skipping , so instruction counts are the
+// full budget , or up to the halt for a lane that quit
+static void run_lane_chunk(const batch_t * batch, worker_t * worker, uint64_t unit){
+    const uint32_t rom_index = unit / batch->chunks;
+    const chip8_t * rom = &batch->roms[rom_index];
+    const uint64_t first = (uint64_t) rom_index * batch->per_rom + (unit % batch->chunks) * LANE_WIDTH;
+    const uint64_t end = (uint64_t) (rom_index + 1) * batch->per_rom;
+    const uint32_t count = end - first < LANE_WIDTH ? end - first : LANE_WIDTH;
+
+    lanes_load(worker->lanes, count, &rom->ram[0x200], sizeof(rom->ram) - 0x200, rom->rom_name);
+
+    // every lane runs the same clock , one frame_budget remainder does for all
+    uint32_t acc = 0;
+    input_t inputs[LANE_WIDTH];
+    for(uint32_t l = 0; l < count; l++){
+        init_input(batch, first + l, &inputs[l]);
+        lanes_seed(worker->lanes, l, instance_seed(batch, first + l));
+    }
+
+    for(uint32_t frame = 0; frame < batch->frames; frame++){
+        for(uint32_t l = 0; l < count; l++) lanes_set_keys(worker->lanes, l, next_keys(batch, &inputs[l], frame));
+        lanes_run(worker->lanes, &batch->config, frame_budget(batch->config.inst_per_second, &acc));
+        lanes_update_timers(worker->lanes);
+    }
+
+    for(uint32_t l = 0; l < count; l++)
+        store_result(batch, first + l, lanes_machine(worker->lanes, l),
+                     lanes_instructions(worker->lanes, l));
+
+    uint64_t vector_steps, scalar_steps;
+    lanes_stats(worker->lanes, &vector_steps, &scalar_steps);
+    worker->vector_steps += vector_steps;
+    worker->scalar_steps += scalar_steps;
+}
+
+// next instance from the worker's own range , UINT64_MAX when it's empty
+static uint64_t take_own(range_t * range){
+    uint64_t index = UINT64_MAX;
+    pthread_mutex_lock(&range->lock);
+    if(range->next < range->end) index = range->next++;
+    pthread_mutex_unlock(&range->lock);
+    return index;
+}
+
+// move the top half of the fullest other range into ours , false when
+// there's nothing left anywhere
+static bool steal(worker_t * worker){
+    batch_t * batch = worker->batch;
+
+    for(;;){
+        worker_t * victim = NULL;
+        uint64_t most = 0;
+        for(uint32_t i = 0; i < batch->worker_count; i++){
+            worker_t * other = &batch->workers[i];
+            if(other == worker) continue;
+            // only picks a victim , the size is checked again under its lock below
+            pthread_mutex_lock(&other->range.lock);
+            const uint64_t left = other->range.end - other->range.next;
+            pthread_mutex_unlock(&other->range.lock);
+            if(left > most){
+                most = left;
+                victim = other;
+            }
+        }
+        if(!victim) return false;
+
+        uint64_t start = 0, end = 0;
+        pthread_mutex_lock(&victim->range.lock);
+        const uint64_t left = victim->range.end - victim->range.next;
+        if(left){
+            end = victim->range.end;
+            start = end - (left + 1) / 2;
+            victim->range.end = start;
+        }
+        pthread_mutex_unlock(&victim->range.lock);
+
+        // the victim ran dry in between , look again
+        if(start == end) continue;
+
+        pthread_mutex_lock(&worker->range.lock);
+        worker->range.next = start;
+        worker->range.end = end;
+        pthread_mutex_unlock(&worker->range.lock);
+        worker->steals++;
+        return true;
+    }
+}
+
+static void * worker_thread(void * data){
+    worker_t * worker = data;
+    chip8_t * chip8 = malloc(sizeof(*chip8));
+    if(!chip8) return NULL;
+
+    for(;;){
+        uint64_t index = take_own(&worker->range);
+        if(index == UINT64_MAX){
+            if(!steal(worker)) break;
+            continue;
+        }
+        if(worker->lanes) run_lane_chunk(worker->batch, worker, index);
+        else run_instance(worker->batch, worker, index, chip8);
+    }
+
+    free(chip8);
+    return NULL;
+}
+
+int main(int argc, char ** argv){
+    static batch_t batch;
+
+    init_config(&batch.config);
+    batch.frames = 600;
+    batch.per_rom = 1;
+    batch.seed = 1;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t threads = cores > 0 ? cores : 1;
+    const char * out_path = NULL;
+    bool quiet = false;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:f:c:e:j:k:rs:lo:q")) != -1){
+        switch(opt){
+            case 'n': batch.per_rom = strtoul(optarg, NULL, 0); break;
+            case 'f': batch.frames = strtoul(optarg, NULL, 0); break;
+            case 'c': batch.config.inst_per_second = strtoul(optarg, NULL, 0); break;
+            case 'e':
+                if(!parse_extension(optarg, &batch.config.current_extension)) return EXIT_FAILURE;
+                break;
+            case 'j': threads = strtoul(optarg, NULL, 0); break;
+            case 'k':
+                if(!movie_load(&batch.script, optarg)) return EXIT_FAILURE;
+                break;
+            case 'r': batch.random_input = true; break;
+            case 's': batch.seed = strtoul(optarg, NULL, 0); break;
+            case 'l': batch.lockstep = true; break;
+            case 'o': out_path = optarg; break;
+            case 'q': quiet = true; break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(optind >= argc || argc - optind > MAX_ROMS || !batch.per_rom || !threads ||
+       batch.config.inst_per_second < 60){
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    // xo-chip gets its 64 KB like in chip8-run , lanes only hold 4 KB machines
+    const bool xo = batch.config.current_extension == XOCHIP;
+    if(xo && batch.lockstep){
+        fprintf(stderr, "-l runs 4 KB machines , xochip needs 64 KB\n");
+        return EXIT_FAILURE;
+    }
+
+    for(int i = optind; i < argc; i++){
+        chip8_t * rom = &batch.roms[batch.rom_count++];
+        if(xo){
+            uint8_t * xo_ram = calloc(1, XO_RAM_SIZE);
+            if(!xo_ram){
+                fprintf(stderr, "Out of memory for %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            attach_xo_ram(rom, xo_ram);
+        }
+        if(!init_chip8(rom, argv[i])) return EXIT_FAILURE;
+    }
+
+    const uint64_t total = (uint64_t) batch.per_rom * batch.rom_count;
+    batch.chunks = batch.lockstep ? (batch.per_rom + LANE_WIDTH - 1) / LANE_WIDTH : batch.per_rom;
+    const uint64_t units = (uint64_t) batch.chunks * batch.rom_count;
+    if(threads > units) threads = units;
+
+    batch.results = calloc(total, sizeof(*batch.results));
+    batch.workers = calloc(threads, sizeof(*batch.workers));
+    if(!batch.results || !batch.workers){
+        fprintf(stderr, "Out of memory for %llu instances\n", (unsigned long long) total);
+        return EXIT_FAILURE;
+    }
+    batch.worker_count = threads;
+
+    // an even split to start with , stealing evens out the rest
+    for(uint32_t i = 0; i < threads; i++){
+        worker_t * worker = &batch.workers[i];
+        worker->batch = &batch;
+        worker->range.next = units * i / threads;
+        worker->range.end = units * (i + 1) / threads;
+        pthread_mutex_init(&worker->range.lock, NULL);
+        worker->decode_cache = malloc(sizeof(*worker->decode_cache));
+        if(batch.lockstep) worker->lanes = lanes_create(LANE_WIDTH);
+        if(xo) worker->xo_ram = malloc(XO_RAM_SIZE);
+        if(!worker->decode_cache || (batch.lockstep && !worker->lanes) || (xo && !worker->xo_ram)){
+            fprintf(stderr, "Out of memory for the workers\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    const double start = now_seconds();
+    for(uint32_t i = 0; i < threads; i++)
+        if(pthread_create(&batch.workers[i].thread, NULL, worker_thread, &batch.workers[i]) != 0){
+            fprintf(stderr, "Could not start worker %u\n", i);
+            return EXIT_FAILURE;
+        }
+
+    uint64_t steals = 0, vector_steps = 0, scalar_steps = 0;
+    for(uint32_t i = 0; i < threads; i++){
+        pthread_join(batch.workers[i].thread, NULL);
+        steals += batch.workers[i].steals;
+        vector_steps += batch.workers[i].vector_steps;
+        scalar_steps += batch.workers[i].scalar_steps;
+        free(batch.workers[i].decode_cache);
+        lanes_destroy(batch.workers[i].lanes);
+        free(batch.workers[i].xo_ram);
+        pthread_mutex_destroy(&batch.workers[i].range.lock);
+    }
+    const double elapsed = now_seconds() - start;
+
+    uint64_t instructions = 0;
+    for(uint64_t i = 0; i < total; i++) instructions += batch.results[i].instructions;
+
+    if(!quiet){
+        FILE * out = out_path ? fopen(out_path, "w") : stdout;
+        if(!out){
+            fprintf(stderr, "Could not write results to %s\n", out_path);
+            return EXIT_FAILURE;
+        }
+        fprintf(out, "# instance rom variant instructions display PC I SP state V0..VF\n");
+        for(uint64_t i = 0; i < total; i++){
+            const result_t * result = &batch.results[i];
+            fprintf(out, "%llu %s %llu %llu %08X %03X %03X %u %s ", (unsigned long long) i,
+                    batch.roms[i / batch.per_rom].rom_name, (unsigned long long) (i % batch.per_rom),
+                    (unsigned long long) result->instructions, result->display_hash, result->PC, result->I,
+                    result->stack_depth, result->state == QUIT ? "quit" : "run");
+            for(int v = 0; v < 16; v++) fprintf(out, "%02X", result->V[v]);
+            fprintf(out, "\n");
+        }
+        if(out != stdout) fclose(out);
+    }
+
+    fprintf(stderr, "instances    %llu (%u threads , %llu steals)\n",
+            (unsigned long long) total, threads, (unsigned long long) steals);
+    fprintf(stderr, "instructions %llu\n", (unsigned long long) instructions);
+    if(batch.lockstep && vector_steps + scalar_steps)
+        fprintf(stderr, "vector       %.1f%% of lane instructions\n",
+                100.0 * vector_steps / (vector_steps + scalar_steps));
+    fprintf(stderr, "seconds      %.6f\n", elapsed);
+    fprintf(stderr, "instances/s  %.0f\n", elapsed > 0 ? total / elapsed : 0.0);
+    fprintf(stderr, "inst/sec     %.0f (%.2f MIPS)\n",
+            elapsed > 0 ? instructions / elapsed : 0.0, elapsed > 0 ? instructions / elapsed / 1e6 : 0.0);
+
+    for(uint32_t i = 0; i < batch.rom_count; i++) free(batch.roms[i].xo_ram);
+    free(batch.results);
+    free(batch.workers);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,394 @@
+// benchmark runner , a few synthetic micro roms plus any real roms given on
+// the command line. every workload runs headless for a fixed number of frames
+// with a fixed seed , in each execution mode , and the median of the repeats is
+// reported so two builds can be diffed (text table on stdout , json with -o)
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8_core.h"
+#include "chip8_jit.h"
+#include "chip8_fork.h"
+#include "chip8_record.h"
+
+#define MAX_WORKLOADS 32
+#define MAX_REPEATS 64
+
+// 8XYN soup , every ALU op in a tight loop
+static const uint8_t alu_rom[] = {
+    0x60, 0x01,  // 200: V0 = 01
+    0x61, 0x03,  // 202: V1 = 03
+    0x80, 0x14,  // 204: V0 += V1
+    0x81, 0x25,  // 206: V1 -= V2
+    0x82, 0x31,  // 208: V2 |= V3
+    0x83, 0x42,  // 20A: V3 &= V4
+    0x84, 0x53,  // 20C: V4 ^= V5
+    0x85, 0x06,  // 20E: V5 = V0 >> 1
+    0x86, 0x1E,  // 210: V6 = V1 << 1
+    0x87, 0x67,  // 212: V7 = V6 - V7
+    0x88, 0x70,  // 214: V8 = V7
+    0x72, 0x05,  // 216: V2 += 05
+    0x12, 0x04,  // 218: jump 204
+};
+
+// DXYN storm , a 15 row sprite drawn at a walking position every third opcode
+static const uint8_t sprite_rom[] = {
+    0xA0, 0x00,  // 200: I = 000 (font , 15 rows of it)
+    0xD0, 0x1F,  // 202: draw 8x15 at V0 , V1
+    0x70, 0x07,  // 204: V0 += 07
+    0x71, 0x03,  // 206: V1 += 03
+    0x12, 0x02,  // 208: jump 202
+};
+
+// three deep call / return chain
+static const uint8_t call_rom[] = {
+    0x22, 0x06,  // 200: call 206
+    0x70, 0x01,  // 202: V0 += 01
+    0x12, 0x00,  // 204: jump 200
+    0x22, 0x0C,  // 206: call 20C
+    0x71, 0x01,  // 208: V1 += 01
+    0x00, 0xEE,  // 20A: return
+    0x22, 0x12,  // 20C: call 212
+    0x72, 0x01,  // 20E: V2 += 01
+    0x00, 0xEE,  // 210: return
+    0x73, 0x01,  // 212: V3 += 01
+    0x00, 0xEE,  // 214: return
+};
+
+// BCD then register store / load through ram , the ram write path
+static const uint8_t memory_rom[] = {
+    0xA3, 0x00,  // 200: I = 300
+    0xF3, 0x33,  // 202: BCD of V3 at 300
+    0xA3, 0x03,  // 204: I = 303
+    0xF3, 0x55,  // 206: store V0..V3 at 303
+    0xA3, 0x00,  // 208: I = 300
+    0xF2, 0x65,  // 20A: load V0..V2 from 300
+    0x73, 0x07,  // 20C: V3 += 07
+    0x12, 0x00,  // 20E: jump 200
+};
+
+typedef struct{
+    const char * name;
+    const uint8_t * image;
+    size_t size;
+} workload_t;
+
+typedef enum {
+    UNCACHED,  // decode every instruction
+    CACHED,    // decode cache
+    JIT,       // decode cache + x86-64 jit
+    FORK,      // decode cache + a fork search every frame
+    RECORD,    // decode cache + every frame and instruction to the recorder
+    VIP,       // decode cache + the cycle schedule instead of counting instructions
+} bench_mode_t;
+
+static const char * const mode_names[] = { "uncached", "cached", "jit", "fork", "record", "vip" };
+
+// cycle budget of a vip frame , about the instructions the counting modes run
+#define VIP_BENCH_CYCLES_PER_INST 20
+
+#define FORK_BRANCHES 4
+
+typedef struct{
+    uint64_t instructions;
+    uint64_t frames;
+    double seconds;         // whole run
+    double render_seconds;  // pixel conversion part of it
+    uint32_t display_hash;
+    uint64_t dropped;       // record mode , frames and trace records the writer had no room for
+} sample_t;
+
+typedef struct{
+    uint64_t frames;
+    uint32_t repeats;
+    unsigned int seed;
+    const config_t * config;
+} bench_t;
+
+static void usage(const char * prog){
+    fprintf(stderr,
+        "Usage %s [options] [rom_name ...]\n"
+        "  -f N   frames per run (default 300)\n"
+        "  -c N   instructions per second of the emulated clock (default 600000)\n"
+        "  -e S   quirks of chip8 , schip or xochip (default chip8)\n"
+        "  -r N   measured runs per workload , the median is reported (default 5)\n"
+        "  -s N   seed for CXNN random numbers (default 1)\n"
+        "  -m S   modes to run , any of u (uncached) c (cached) j (jit) f (fork)\n"
+        "         r (record , video and trace to /dev/null) v (vip , cycle schedule)\n"
+        "         (default ucjfrv)\n"
+        "  -o F   also write the results to F as json\n",
+        prog);
+}
+
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// one headless run , the same frame loop as chip8-run plus converting the
+// dirty rows to pixels after every frame the way the front end would
+static bool run_once(const bench_t * bench, const workload_t * workload, bench_mode_t mode,
+                     sample_t * sample){
+    static chip8_t chip8;
+    static decode_cache_t decode_cache;
+    static uint8_t xo_ram[XO_RAM_SIZE];
+    static uint32_t pixels[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+
+    memset(&chip8, 0, sizeof(chip8));
+    // xo-chip runs in its 64 KB like in chip8-run , which the decode cache
+    // doesn't cover and forks don't take
+    if(bench->config->current_extension == XOCHIP) attach_xo_ram(&chip8, xo_ram);
+    if(!init_chip8_image(&chip8, workload->image, workload->size, workload->name)) return false;
+    if(mode != UNCACHED) attach_decode_cache(&chip8, &decode_cache);
+
+    jit_t * jit = NULL;
+    if(mode == JIT){
+        jit = jit_create(0);
+        if(!jit) return false;
+        jit_attach(jit, &chip8);
+    }
+
+    fork_pool_t * pool = NULL;
+    if(mode == FORK){
+        if(chip8.xo_ram) return false;
+        pool = fork_pool_create();
+        if(!pool) return false;
+    }
+
+    recorder_t * recorder = NULL;
+    if(mode == RECORD){
+        static const uint32_t palette[4] = { 0x000000FF, 0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF };
+        recorder = recorder_create("/dev/null", "/dev/null", palette, 0, 0);
+        if(!recorder) return false;
+    }
+
+    seed_chip8(&chip8, bench->seed);
+
+    const interpreter_t * interpreter = select_interpreter(bench->config->current_extension);
+    const uint32_t inst_per_frame = bench->config->inst_per_second / 60;
+    config_t vip_config = *bench->config;
+    vip_config.cycles_per_frame = inst_per_frame * VIP_BENCH_CYCLES_PER_INST;
+    uint64_t instructions = 0, target = 0, frames = 0, branch_instructions = 0;
+    double render_seconds = 0;
+
+    const double start = now_seconds();
+
+    for(; frames < bench->frames && chip8.state != QUIT; frames++){
+        target += inst_per_frame;
+        if(pool){
+            // a one frame deep search , each branch holds a different key down
+            // for a quarter frame from a clone , then the frame runs for real
+            fork_t * root = fork_clone(pool, &chip8);
+            for(uint32_t b = 0; root && b < FORK_BRANCHES; b++){
+                fork_restore(pool, &chip8, root);
+                chip8.keypads[b] = true;
+                for(uint32_t i = 0; i < inst_per_frame / FORK_BRANCHES; i++) interpreter->step(&chip8, bench->config);
+                branch_instructions += inst_per_frame / FORK_BRANCHES;
+            }
+            if(root){
+                fork_restore(pool, &chip8, root);
+                fork_release(pool, root);
+            }
+        }
+        if(jit){
+            if(instructions < target) instructions += jit_run(jit, &chip8, bench->config, target - instructions);
+        }
+        else if(mode == VIP){
+            // the schedule carries its own overshoot , keep target in step with it
+            instructions += interpreter->run_cycles(&chip8, &vip_config, inst_per_frame * VIP_BENCH_CYCLES_PER_INST);
+            target = instructions;
+        }
+        else if(recorder){
+            if(instructions < target)
+                instructions += recorder_run(recorder, interpreter, &chip8, bench->config, target - instructions);
+        }
+        else {
+            for(; instructions < target; instructions++) interpreter->step(&chip8, bench->config);
+        }
+        update_timers(&chip8);
+        if(recorder) recorder_frame(recorder, &chip8);
+
+        // both planes for xo-chip , like the front end
+        const double render_start = now_seconds();
+        const uint64_t rows = take_dirty_rows(&chip8);
+        if(rows && bench->config->current_extension == XOCHIP)
+            planes_to_pixels(chip8.display, chip8.display2, display_width(&chip8), bench->config->palette, pixels,
+                             __builtin_ctzll(rows), 63 - __builtin_clzll(rows));
+        else if(rows)
+            display_to_pixels(chip8.display, display_width(&chip8), 0xFFFFFFFF, 0x000000FF, pixels,
+                              __builtin_ctzll(rows), 63 - __builtin_clzll(rows));
+        render_seconds += now_seconds() - render_start;
+    }
+
+    sample->seconds = now_seconds() - start;
+    sample->render_seconds = render_seconds;
+    sample->instructions = instructions + branch_instructions;
+    sample->frames = frames;
+    sample->display_hash = display_hash(&chip8);
+    sample->dropped = 0;
+
+    // the writer's drain at the end isn't timed , only what the emulation paid
+    if(recorder){
+        record_stats_t stats;
+        recorder_stats(recorder, &stats);
+        sample->dropped = stats.frames_dropped + stats.trace_dropped;
+        recorder_destroy(recorder);
+    }
+    jit_destroy(jit);
+    if(pool){
+        fork_detach(pool, &chip8);
+        fork_pool_destroy(pool);
+    }
+    return true;
+}
+
+// s as a json string , quotes , backslashes and control characters escaped
+static void json_string(FILE * json, const char * s){
+    fputc('"', json);
+    for(; *s; s++){
+        const unsigned char c = *s;
+        if(c == '"' || c == '\\') fprintf(json, "\\%c", c);
+        else if(c < 0x20) fprintf(json, "\\u%04x", c);
+        else fputc(c, json);
+    }
+    fputc('"', json);
+}
+
+static int by_run_time(const void * a, const void * b){
+    const double ta = ((const sample_t *) a)->seconds - ((const sample_t *) a)->render_seconds;
+    const double tb = ((const sample_t *) b)->seconds - ((const sample_t *) b)->render_seconds;
+    return (ta > tb) - (ta < tb);
+}
+
+static double inst_per_sec(const sample_t * sample){
+    const double run = sample->seconds - sample->render_seconds;
+    return run > 0 ? sample->instructions / run : 0.0;
+}
+
+int main(int argc, char ** argv){
+    config_t config = {0};
+    init_config(&config);
+    config.inst_per_second = 600000;
+
+    bench_t bench = { .frames = 300, .repeats = 5, .seed = 1, .config = &config };
+    const char * modes = "ucjfrv";
+    const char * json_path = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "f:c:r:s:m:o:e:")) != -1){
+        switch(opt){
+            case 'f': bench.frames = strtoull(optarg, NULL, 0); break;
+            case 'c': config.inst_per_second = strtoul(optarg, NULL, 0); break;
+            case 'e':
+                if(!parse_extension(optarg, &config.current_extension)) return EXIT_FAILURE;
+                break;
+            case 'r': bench.repeats = strtoul(optarg, NULL, 0); break;
+            case 's': bench.seed = strtoul(optarg, NULL, 0); break;
+            case 'm': modes = optarg; break;
+            case 'o': json_path = optarg; break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(config.inst_per_second < 60 || !bench.frames || !bench.repeats || bench.repeats > MAX_REPEATS){
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    workload_t workloads[MAX_WORKLOADS] = {
+        { "alu",    alu_rom,    sizeof(alu_rom) },
+        { "sprite", sprite_rom, sizeof(sprite_rom) },
+        { "call",   call_rom,   sizeof(call_rom) },
+        { "memory", memory_rom, sizeof(memory_rom) },
+    };
+    uint32_t workload_count = 4;
+
+    // real roms are loaded once through init_chip8 and replayed from memory ,
+    // from a 64 KB image for xochip
+    static chip8_t roms[MAX_WORKLOADS];
+    static uint8_t xo_images[MAX_WORKLOADS][XO_RAM_SIZE];
+    for(int i = optind; i < argc; i++){
+        if(workload_count == MAX_WORKLOADS){
+            fprintf(stderr, "Too many roms , at most %d\n", MAX_WORKLOADS - 4);
+            return EXIT_FAILURE;
+        }
+        chip8_t * rom = &roms[workload_count];
+        if(config.current_extension == XOCHIP) attach_xo_ram(rom, xo_images[workload_count]);
+        if(!init_chip8(rom, argv[i])) return EXIT_FAILURE;
+        workloads[workload_count++] = (workload_t){ argv[i], chip8_ram(rom) + 0x200, ram_size(rom) - 0x200 };
+    }
+
+    FILE * json = NULL;
+    if(json_path){
+        json = fopen(json_path, "w");
+        if(!json){
+            fprintf(stderr, "Could not write results to %s\n", json_path);
+            return EXIT_FAILURE;
+        }
+        fprintf(json, "{\n  \"frames\": %llu,\n  \"inst_per_second\": %u,\n  \"repeats\": %u,\n"
+                      "  \"seed\": %u,\n  \"results\": [",
+                (unsigned long long) bench.frames, config.inst_per_second, bench.repeats, bench.seed);
+    }
+
+    printf("%-16s %-8s %14s %10s %12s %12s %10s\n",
+           "workload", "mode", "inst/sec", "ns/op", "frames/sec", "render ns/f", "display");
+
+    const char * sep = "";
+    for(uint32_t w = 0; w < workload_count; w++){
+        for(bench_mode_t mode = UNCACHED; mode <= VIP; mode++){
+            if(!strchr(modes, mode_names[mode][0])) continue;
+
+            // one unmeasured run to warm caches and the jit's code buffer
+            sample_t samples[MAX_REPEATS];
+            if(!run_once(&bench, &workloads[w], mode, &samples[0])){
+                if(mode == JIT) fprintf(stderr, "jit not available on this host , skipped\n");
+                if(mode == FORK) fprintf(stderr, "forks only take 4 KB machines , skipped\n");
+                continue;
+            }
+            for(uint32_t r = 0; r < bench.repeats; r++) run_once(&bench, &workloads[w], mode, &samples[r]);
+            qsort(samples, bench.repeats, sizeof(samples[0]), by_run_time);
+
+            const sample_t * median = &samples[bench.repeats / 2];
+            const double ips = inst_per_sec(median);
+            const double ns_per_op = ips > 0 ? 1e9 / ips : 0.0;
+            const double fps = median->seconds > 0 ? median->frames / median->seconds : 0.0;
+            const double render_ns = median->frames ? median->render_seconds * 1e9 / median->frames : 0.0;
+
+            printf("%-16s %-8s %14.0f %10.2f %12.0f %12.0f   %08X\n", workloads[w].name, mode_names[mode],
+                   ips, ns_per_op, fps, render_ns, median->display_hash);
+            if(mode == RECORD && median->dropped)
+                printf("%-16s %-8s %llu frames and trace records dropped\n", "", "",
+                       (unsigned long long) median->dropped);
+
+            if(json){
+                fprintf(json, "%s\n    { \"workload\": ", sep);
+                json_string(json, workloads[w].name);
+                fprintf(json, ", \"mode\": \"%s\", \"instructions\": %llu, "
+                              "\"frames\": %llu,\n      \"inst_per_sec\": %.0f, \"inst_per_sec_best\": %.0f, "
+                              "\"inst_per_sec_worst\": %.0f,\n      \"ns_per_op\": %.3f, \"frames_per_sec\": %.1f, "
+                              "\"render_ns_per_frame\": %.1f, \"display\": \"%08X\", \"dropped\": %llu }",
+                        mode_names[mode],
+                        (unsigned long long) median->instructions, (unsigned long long) median->frames,
+                        ips, inst_per_sec(&samples[0]), inst_per_sec(&samples[bench.repeats - 1]),
+                        ns_per_op, fps, render_ns, median->display_hash, (unsigned long long) median->dropped);
+                sep = ",";
+            }
+        }
+    }
+
+    if(json){
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+    return EXIT_SUCCESS;
+}
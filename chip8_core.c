@@ -0,0 +1,1053 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chip8_core.h"
+#include "chip8_profile.h"
+
+#define BIG_FONT 0x50 // super-chip digits , right after the small font
+
+void init_config(config_t * config){
+    config -> window_height = 32;    // chip-8 original resolution
+    config -> window_width = 64;
+    config->fg_color = 0xFFFFFFFF; // white
+    config->bg_color = 0x00000000; // black
+    config->palette[0] = config->bg_color;
+    config->palette[1] = config->fg_color;
+    config->palette[2] = 0xAAAAAAFF; // light grey , plane 2 only
+    config->palette[3] = 0x555555FF; // dark grey , both planes
+    config->scale_factor = 20;
+    config->inst_per_second = 700;
+    config->cycles_per_frame = 0; // every instruction costs the same
+    config->display_wait = false;
+    config->turbo_factor = 10;
+    config->show_stats = false;
+    config->square_wave_freq = 440;
+    config->volume = 2500; // max = 320000
+    config->audio_sample_rate = 44100; // cd quality
+    config->current_extension = CHIP8;
+    config->pixel_outlines = true;
+    config->rewind_bytes = 4u << 20; // 4 MB , 10+ minutes of most games
+    config->seed = 0; // from the clock
+    config->movie_path = NULL;
+    config->video_path = NULL;
+    config->trace_path = NULL;
+}
+
+static const char * const extension_names[] = { [CHIP8] = "chip8", [SUPERCHIP] = "schip", [XOCHIP] = "xochip" };
+
+bool parse_extension(const char * name, extension_t * extension){
+    for(extension_t i = CHIP8; i <= XOCHIP; i++)
+        if(strcmp(name, extension_names[i]) == 0){
+            *extension = i;
+            return true;
+        }
+    fprintf(stderr,"Unknown extension %s (chip8 , schip or xochip)\n",name);
+    return false;
+}
+
+const char * extension_name(extension_t extension){
+    return extension_names[extension];
+}
+
+const char * fault_name(fault_t fault){
+    static const char * const names[] = {
+        [FAULT_NONE] = "none",
+        [FAULT_STACK_OVERFLOW] = "stack overflow",
+        [FAULT_STACK_UNDERFLOW] = "stack underflow",
+        [FAULT_BAD_KEY] = "key above F",
+    };
+    return fault < sizeof(names) / sizeof(names[0]) ? names[fault] : "unknown";
+}
+
+bool init_chip8(chip8_t * chip8, const char rom_name []){
+    FILE * rom = fopen(rom_name,"rb");
+    if(!rom){
+        fprintf(stderr,"Rom dosen't exist\n");
+        return false;
+    }
+    fseek(rom,0,SEEK_END);
+    const size_t rom_size = ftell(rom);
+    rewind(rom);
+
+    if(rom_size > ram_size(chip8) - 0x200){
+        fprintf(stderr,"Rom size is too big ...\n");
+        fclose(rom);
+        return false;
+    }
+
+    // up to 64 KB , on the heap so loads on other threads don't share it
+    uint8_t * image = malloc(rom_size ? rom_size : 1);
+    if(!image || fread(image,rom_size,1,rom) != 1){
+        fprintf(stderr,"Cannot read into the rom file ..\n");
+        free(image);
+        fclose(rom);
+        return false;
+    }
+
+    fclose(rom);
+
+    const bool loaded = init_chip8_image(chip8, image, rom_size, rom_name);
+    free(image);
+    return loaded;
+}
+
+bool init_chip8_image(chip8_t * chip8, const uint8_t * image, size_t size, const char rom_name []){
+    const uint32_t starting_point = 0x200;
+    const uint8_t font[] = {
+        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+        0x20, 0x60, 0x20, 0x20, 0x70, // 1
+        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+    };
+    // super-chip 8x10 digits , xo-chip adds A-F
+    const uint8_t big_font[] = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+    uint8_t * ram = chip8_ram(chip8);
+    if(size > ram_size(chip8) - starting_point){
+        fprintf(stderr,"Rom size is too big ...\n");
+        return false;
+    }
+    if(chip8->xo_ram) memset(chip8->xo_ram, 0, XO_RAM_SIZE); // the attachment may have run another rom
+
+    //load font
+
+    memcpy(&ram[0],font,sizeof(font));
+    memcpy(&ram[BIG_FONT],big_font,sizeof(big_font));
+    //load rom
+
+    memcpy(&ram[starting_point],image,size);
+
+    // new rom , nothing decoded or translated so far is valid anymore
+    ram_written(chip8, 0, ram_size(chip8));
+
+    chip8->state = RUNNING;
+    chip8->fault = FAULT_NONE;
+    chip8->cycle_debt = 0;
+    chip8->wait_vblank = 0;
+    chip8->keys_read = 0;
+    chip8->PC = starting_point;
+    chip8->rom_name = rom_name;
+    chip8->SP = 0;
+    chip8->wait_key = 0xFF;
+    chip8->hires = false;
+    chip8->planes = 1;
+    chip8->dirty_rows = ~0ull; // first frame draws everything
+    chip8->pitch = 64; // 4000 hz
+    chip8->pattern_loaded = false;
+    seed_chip8(chip8, 1);
+    return true;
+}
+
+void attach_xo_ram(chip8_t * chip8, uint8_t * ram){
+    chip8->xo_ram = ram;
+}
+
+void seed_chip8(chip8_t * chip8, uint32_t seed){
+    chip8->rng = seed ? seed : 0x9E3779B9u; // xorshift would stay at 0 forever
+}
+
+// instruction handlers , one per opcode. PC already points at the next opcode
+// when these run
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+// dirty_rows bits of every row on screen at the current resolution
+static inline uint64_t screen_rows(const chip8_t * chip8){
+    return chip8->hires ? ~0ull : (1ull << LORES_HEIGHT) - 1;
+}
+
+// plane 0 is display , plane 1 the xo-chip display2
+static inline uint64_t (*plane(chip8_t * chip8, uint32_t p))[DISPLAY_WORDS]{
+    return p ? chip8->display2 : chip8->display;
+}
+
+// memory and address mask a handler works on , a constant 4 KB unless ext is
+// xo-chip , which may have the 64 KB attached
+ALWAYS_INLINE uint8_t * memory(chip8_t * chip8, extension_t ext){
+    return ext == XOCHIP ? chip8_ram(chip8) : chip8->ram;
+}
+
+ALWAYS_INLINE uint32_t memory_mask(const chip8_t * chip8, extension_t ext){
+    return (ext == XOCHIP ? ram_size(chip8) : sizeof(chip8->ram)) - 1;
+}
+
+static void op_nop(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)chip8; (void)inst; (void)config; //unimplimented opcode
+}
+
+// clears and scrolls only touch the planes FN01 selected
+static void op_00E0(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)inst; (void)config;
+    for(uint32_t p = 0; p < 2; p++)
+        if((chip8->planes >> p) & 1) memset(plane(chip8, p), 0, sizeof(chip8->display));
+    chip8->dirty_rows = ~0ull;
+}
+
+// super-chip scrolling. rows are packed , so moving down is one memmove and
+// sideways is a shift per row word with the bits carried across the pair.
+// lores only ever touches word 0 , word 1 stays clear
+static void op_00CN(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    const uint32_t height = display_height(chip8);
+    for(uint32_t p = 0; p < 2; p++){
+        if(!((chip8->planes >> p) & 1)) continue;
+        uint64_t (*display)[DISPLAY_WORDS] = plane(chip8, p);
+        memmove(&display[inst->N], &display[0], (height - inst->N) * sizeof(display[0]));
+        memset(&display[0], 0, inst->N * sizeof(display[0]));
+    }
+    chip8->dirty_rows |= screen_rows(chip8);
+}
+
+// xo-chip , the same upwards
+static void op_00DN(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    const uint32_t height = display_height(chip8);
+    for(uint32_t p = 0; p < 2; p++){
+        if(!((chip8->planes >> p) & 1)) continue;
+        uint64_t (*display)[DISPLAY_WORDS] = plane(chip8, p);
+        memmove(&display[0], &display[inst->N], (height - inst->N) * sizeof(display[0]));
+        memset(&display[height - inst->N], 0, inst->N * sizeof(display[0]));
+    }
+    chip8->dirty_rows |= screen_rows(chip8);
+}
+
+static void op_00FB(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)inst; (void)config;
+    const uint32_t height = display_height(chip8);
+    for(uint32_t p = 0; p < 2; p++){
+        if(!((chip8->planes >> p) & 1)) continue;
+        uint64_t (*display)[DISPLAY_WORDS] = plane(chip8, p);
+        for(uint32_t y = 0; y < height; y++){
+            uint64_t * row = display[y];
+            if(chip8->hires) row[1] = (row[1] >> 4) | (row[0] << 60);
+            row[0] >>= 4;
+        }
+    }
+    chip8->dirty_rows |= screen_rows(chip8);
+}
+
+static void op_00FC(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)inst; (void)config;
+    const uint32_t height = display_height(chip8);
+    for(uint32_t p = 0; p < 2; p++){
+        if(!((chip8->planes >> p) & 1)) continue;
+        uint64_t (*display)[DISPLAY_WORDS] = plane(chip8, p);
+        for(uint32_t y = 0; y < height; y++){
+            uint64_t * row = display[y];
+            row[0] <<= 4;
+            if(chip8->hires){
+                row[0] |= row[1] >> 60;
+                row[1] <<= 4;
+            }
+        }
+    }
+    chip8->dirty_rows |= screen_rows(chip8);
+}
+
+// stop the program on the instruction that ran (PC is past it) , as a jump to
+// itself so the run loops end the slice and stepping on only repeats it
+static void halt(chip8_t * chip8, fault_t fault){
+    chip8->fault = fault;
+    chip8->state = QUIT;
+    chip8->PC -= 2;
+    chip8->idle_cycle = 1;
+}
+
+static void op_00FD(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)inst; (void)config;
+    halt(chip8, FAULT_NONE); // exit interpreter
+}
+
+// 00FE lores , 00FF hires. the screen starts over blank at the new size ,
+// every plane of it
+static void op_00FE(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->hires = inst->N == 0xF;
+    memset(chip8->display, 0, sizeof(chip8->display));
+    memset(chip8->display2, 0, sizeof(chip8->display2));
+    chip8->dirty_rows = ~0ull;
+}
+
+static void op_00EE(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)inst; (void)config;
+    // return from subroutine
+    if(chip8->SP == 0){
+        halt(chip8, FAULT_STACK_UNDERFLOW);
+        return;
+    }
+    chip8->PC = chip8->stack[--chip8->SP];
+}
+
+static void op_1NNN(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    const uint16_t here = chip8->PC - 2;
+
+    if(inst->NNN == here){
+        chip8->idle_cycle = 1; // jump to itself , halted for good
+    }
+    else if(inst->NNN + 4u == here && here < ram_size(chip8)){
+        // FX07 ; 3XNN ; 1NNN back to the FX07 , waiting on the delay timer.
+        // it can't leave until the timer changes , which only happens on a tick.
+        // VX has to hold this tick's timer value already , or skipping the
+        // FX07 would leave it stale
+        const uint8_t * loop = &chip8_ram(chip8)[inst->NNN];
+        const uint8_t X = loop[0] & 0x0F;
+        if((loop[0] & 0xF0) == 0xF0 && loop[1] == 0x07 && loop[2] == (0x30 | X) &&
+           chip8->delay_timer != loop[3] && chip8->V[X] == chip8->delay_timer)
+            chip8->idle_cycle = 3;
+    }
+
+    chip8->PC = inst->NNN;
+}
+
+static void op_2NNN(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    if(chip8->SP == sizeof(chip8->stack) / sizeof(chip8->stack[0])){
+        halt(chip8, FAULT_STACK_OVERFLOW);
+        return;
+    }
+    chip8->stack[chip8->SP++] = chip8->PC;
+    chip8->PC = inst->NNN;
+}
+
+// skip the next instruction , on xo-chip F000 NNNN is two words long
+ALWAYS_INLINE void skip(chip8_t * chip8, extension_t ext){
+    if(ext == XOCHIP){
+        const uint8_t * ram = chip8_ram(chip8);
+        const uint32_t mask = ram_size(chip8) - 1;
+        if(ram[chip8->PC & mask] == 0xF0 && ram[(chip8->PC + 1) & mask] == 0x00){
+            chip8->PC += 4;
+            return;
+        }
+    }
+    chip8->PC +=2;
+}
+
+ALWAYS_INLINE void op_3XNN(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    // if vx == nn then skip next instruction
+    if(chip8->V[inst->X] == inst->NN) skip(chip8, ext);
+}
+
+ALWAYS_INLINE void op_4XNN(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    // if vx != nn then skip next instruction
+    if(chip8->V[inst->X] != inst->NN) skip(chip8, ext);
+}
+
+ALWAYS_INLINE void op_5XY0(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    if(chip8->V[inst->X] == chip8->V[inst->Y]) skip(chip8, ext);
+}
+
+// xo-chip VX..VY to ram at I and back , in reverse when X > Y. I stays put
+static void op_5XY2(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    uint8_t * ram = chip8_ram(chip8);
+    const uint32_t mask = ram_size(chip8) - 1;
+    const int8_t dir = inst->X <= inst->Y ? 1 : -1;
+    const uint8_t count = (inst->X <= inst->Y ? inst->Y - inst->X : inst->X - inst->Y) + 1;
+
+    ram_written(chip8, chip8->I & mask, count);
+    for(uint8_t i = 0; i < count; i++) ram[(chip8->I + i) & mask] = chip8->V[inst->X + dir * i];
+}
+
+static void op_5XY3(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    const uint8_t * ram = chip8_ram(chip8);
+    const uint32_t mask = ram_size(chip8) - 1;
+    const int8_t dir = inst->X <= inst->Y ? 1 : -1;
+    const uint8_t count = (inst->X <= inst->Y ? inst->Y - inst->X : inst->X - inst->Y) + 1;
+
+    for(uint8_t i = 0; i < count; i++) chip8->V[inst->X + dir * i] = ram[(chip8->I + i) & mask];
+}
+
+static void op_6XNN(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->V[inst->X] = inst->NN;
+}
+
+static void op_7XNN(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->V[inst->X] += inst->NN;
+}
+
+static void op_8XY0(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->V[inst->X] = chip8->V[inst->Y];
+}
+
+ALWAYS_INLINE void op_8XY1(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    chip8->V[inst->X] |= chip8->V[inst->Y];
+    if (ext == CHIP8) chip8->V[0xF] = 0; // chip8 only quirk
+}
+
+ALWAYS_INLINE void op_8XY2(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    chip8->V[inst->X] &= chip8->V[inst->Y];
+    if (ext == CHIP8) chip8->V[0xF] = 0;
+}
+
+ALWAYS_INLINE void op_8XY3(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    chip8->V[inst->X] ^= chip8->V[inst->Y];
+    if (ext == CHIP8) chip8->V[0xF] = 0;
+}
+
+static void op_8XY4(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    const bool carry = ((uint16_t) (chip8->V[inst->X] + chip8->V[inst->Y]) > 255);
+    chip8->V[inst->X] += chip8->V[inst->Y];
+    chip8->V[0xF] = carry;
+}
+
+static void op_8XY5(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    const bool carry = (chip8->V[inst->Y] <= chip8->V[inst->X]);
+    chip8->V[inst->X] -= chip8->V[inst->Y];
+    chip8->V[0xF] = carry;
+}
+
+ALWAYS_INLINE void op_8XY6(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    bool carry;
+
+    if(ext == CHIP8){
+        carry = chip8->V[inst->Y] & 1;
+        chip8->V[inst->X] = chip8->V[inst->Y] >> 1;
+    }
+    else {
+        carry = chip8->V[inst->X] & 1;
+        chip8->V[inst->X] >>=1;
+    }
+    chip8->V[0xF] = carry;
+}
+
+static void op_8XY7(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    const bool carry = (chip8->V[inst->X] <= chip8->V[inst->Y]);
+    chip8->V[inst->X] = chip8->V[inst->Y] - chip8->V[inst->X];
+    chip8->V[0xF] = carry;
+}
+
+ALWAYS_INLINE void op_8XYE(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    bool carry;
+    if(ext == CHIP8){
+        carry = (chip8->V[inst->Y] & 0x80) >> 7;
+        chip8->V[inst->X] = chip8->V[inst->Y] << 1;
+    }
+    else {
+        carry = (chip8->V[inst->Y] & 0x80) >> 7;
+        chip8->V[inst->X] <<=1;
+    }
+    chip8->V[0xF] = carry;
+}
+
+ALWAYS_INLINE void op_9XY0(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    if(chip8->V[inst->X] != chip8->V[inst->Y]) skip(chip8, ext);
+}
+
+static void op_ANNN(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->I = inst->NNN;
+}
+
+static void op_BNNN(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->PC = chip8->V[0] + inst->NNN;
+}
+
+static void op_CXNN(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->V[inst->X] = (xorshift32(&chip8->rng) >> 24) & inst->NN;
+}
+
+// packed rows , so a sprite row is a shift , an AND for the collision test and
+// an XOR to draw it. in hires a sprite can straddle the two words of a row.
+// super-chip DXY0 is a 16x16 sprite , two bytes a row. xo-chip draws it into
+// each plane FN01 selected , plane 2's rows following plane 1's in ram , and
+// wraps around the edges where the others clip
+ALWAYS_INLINE void op_DXYN(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    PROFILE_BEGIN(dxyn);
+    const bool hires = ext != CHIP8 && chip8->hires;
+    const bool wide = ext != CHIP8 && inst->N == 0;
+    const bool wrap = ext == XOCHIP;
+    const uint32_t words = hires ? DISPLAY_WORDS : 1;
+    const uint32_t height = hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+    const uint32_t X = chip8->V[inst->X] & (words * 64 - 1);
+    const uint32_t Y = chip8->V[inst->Y] & (height - 1);
+    const uint32_t rows = wide ? 16 : inst->N;
+    const uint32_t row_bytes = wide ? 2 : 1;
+    const uint8_t planes = ext == XOCHIP ? chip8->planes : 1;
+    const uint8_t * ram = memory(chip8, ext);
+    const uint32_t mask = memory_mask(chip8, ext);
+
+    // the word the sprite starts in , and the one bits shifted out of it go on
+    // in (words = clipped)
+    const uint32_t shift = X & 63;
+    const uint32_t first = X >> 6;
+    const uint32_t next = first + 1 < words ? first + 1 : wrap ? 0 : words;
+
+    uint32_t addr = chip8->I;
+    uint64_t collision = 0;
+
+    for(uint32_t p = 0; p < 2; p++){
+        if(!((planes >> p) & 1)) continue;
+        uint64_t (*display)[DISPLAY_WORDS] = plane(chip8, p);
+
+        for(uint32_t i = 0; i < rows && (wrap || Y + i < height); i++) {
+            // sprite lands at the top of the word , bits shifted off the bottom
+            // are past the right edge of the word
+            const uint32_t a = addr + i * row_bytes;
+            const uint64_t sprite = wide ?
+                ((uint64_t) ram[a & mask] << 56) | ((uint64_t) ram[(a + 1) & mask] << 48) :
+                (uint64_t) ram[a & mask] << 56;
+            const uint32_t y = (Y + i) & (height - 1);
+            uint64_t * row = display[y];
+
+            const uint64_t left = sprite >> shift;
+            collision |= row[first] & left;
+            row[first] ^= left;
+            if(shift && next < words){
+                const uint64_t right = sprite << (64 - shift);
+                collision |= row[next] & right;
+                row[next] ^= right;
+            }
+            if(sprite) chip8->dirty_rows |= 1ull << y;
+        }
+        addr += rows * row_bytes;
+    }
+
+    chip8->V[0xF] = collision != 0; // Set collision flag
+    PROFILE_END(dxyn);
+}
+
+ALWAYS_INLINE void op_EX9E(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    if (chip8->V[inst->X] > 0xF) halt(chip8, FAULT_BAD_KEY);
+    else {
+        chip8->keys_read |= 1u << chip8->V[inst->X];
+        if (chip8->keypads[chip8->V[inst->X]]) skip(chip8, ext);
+    }
+}
+
+ALWAYS_INLINE void op_EXA1(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    if (chip8->V[inst->X] > 0xF) halt(chip8, FAULT_BAD_KEY);
+    else {
+        chip8->keys_read |= 1u << chip8->V[inst->X];
+        if (!chip8->keypads[chip8->V[inst->X]]) skip(chip8, ext);
+    }
+}
+
+static void op_FX0A(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->keys_read |= chip8->wait_key == 0xFF ? 0xFFFF : 1u << chip8->wait_key;
+    for (uint8_t i = 0; chip8->wait_key == 0xFF && i < sizeof chip8->keypads; i++)
+        if (chip8->keypads[i]) {
+            chip8->wait_key = i;
+            break;
+        }
+
+    // nothing pressed yet , or the key is still held down. keys only change
+    // between slices , so once this rewinds it will keep rewinding for the
+    // rest of the slice
+    if (chip8->wait_key == 0xFF || chip8->keypads[chip8->wait_key]){
+        chip8->PC -= 2;
+        chip8->idle_cycle = 1;
+    }
+    else {
+        chip8->V[inst->X] = chip8->wait_key;
+        chip8->wait_key = 0xFF;
+    }
+}
+
+static void op_FX1E(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->I += chip8->V[inst->X];
+}
+
+static void op_FX07(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->V[inst->X] = chip8->delay_timer;
+}
+
+static void op_FX15(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->delay_timer = chip8->V[inst->X];
+}
+
+static void op_FX18(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->sound_timer = chip8->V[inst->X];
+}
+
+// xo-chip audio , the 16 bytes at I become the sound pattern
+static void op_F002(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)inst;
+    (void)config;
+    for(uint8_t i = 0; i < sizeof chip8->audio_pattern; i++)
+        chip8->audio_pattern[i] = chip8_ram(chip8)[(chip8->I + i) & (ram_size(chip8) - 1)];
+    chip8->pattern_loaded = true;
+}
+
+static void op_FX3A(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->pitch = chip8->V[inst->X];
+}
+
+// xo-chip , bit per plane drawn to from now on
+static void op_FN01(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->planes = inst->X & 3;
+}
+
+// xo-chip long I , the address is the next word
+static void op_F000(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)inst; (void)config;
+    const uint8_t * ram = chip8_ram(chip8);
+    const uint32_t mask = ram_size(chip8) - 1;
+    chip8->I = (ram[chip8->PC & mask] << 8) | ram[(chip8->PC + 1) & mask];
+    chip8->PC += 2;
+}
+
+static void op_FX29(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->I = chip8->V[inst->X] *5;
+}
+
+static void op_FX30(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    chip8->I = BIG_FONT + (chip8->V[inst->X] & 0xF) * 10;
+}
+
+static void op_FX33(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)config;
+    uint8_t bcd = chip8->V[inst->X];
+    uint8_t * ram = chip8_ram(chip8);
+    const uint32_t mask = ram_size(chip8) - 1;
+    ram_written(chip8, chip8->I & mask, 3);
+    ram[(chip8->I+2) & mask] = bcd % 10; bcd /=10;
+    ram[(chip8->I+1) & mask] = bcd % 10; bcd /=10;
+    ram[chip8->I & mask] = bcd;
+}
+
+ALWAYS_INLINE void op_FX55(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    uint8_t * ram = memory(chip8, ext);
+    const uint32_t mask = memory_mask(chip8, ext);
+    ram_written(chip8, chip8->I & mask, inst->X + 1);
+    for(uint8_t i =0 ; i<= inst->X; i++){
+        if(ext == CHIP8){
+            ram[chip8->I++ & mask] = chip8->V[i];
+        }
+        else ram[(chip8->I + i) & mask] = chip8->V[i];
+    }
+}
+
+ALWAYS_INLINE void op_FX65(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    const uint8_t * ram = memory(chip8, ext);
+    const uint32_t mask = memory_mask(chip8, ext);
+    for(uint8_t i =0 ; i<= inst->X; i++){
+        if(ext == CHIP8) chip8->V[i] = ram[chip8->I ++ & mask];
+        else  chip8->V[i] = ram[(chip8->I + i) & mask] ;
+    }
+}
+
+// super-chip keeps 8 user flags , xo-chip 16
+ALWAYS_INLINE void op_FX75(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    const uint8_t last = ext == SUPERCHIP && inst->X > 7 ? 7 : inst->X;
+    memcpy(chip8->flags, chip8->V, last + 1);
+}
+
+ALWAYS_INLINE void op_FX85(chip8_t * chip8, const instruction_t * inst, extension_t ext){
+    const uint8_t last = ext == SUPERCHIP && inst->X > 7 ? 7 : inst->X;
+    memcpy(chip8->V, chip8->flags, last + 1);
+}
+
+// the quirk handlers above come in one copy per extension , ext is a constant
+// in each so the quirk test folds away
+#define QUIRK_VARIANTS(op) \
+    static void op##_chip8(chip8_t * chip8, const instruction_t * inst, const config_t * config){ \
+        (void)config; op(chip8, inst, CHIP8); } \
+    static void op##_superchip(chip8_t * chip8, const instruction_t * inst, const config_t * config){ \
+        (void)config; op(chip8, inst, SUPERCHIP); } \
+    static void op##_xochip(chip8_t * chip8, const instruction_t * inst, const config_t * config){ \
+        (void)config; op(chip8, inst, XOCHIP); }
+
+QUIRK_VARIANTS(op_3XNN)
+QUIRK_VARIANTS(op_4XNN)
+QUIRK_VARIANTS(op_5XY0)
+QUIRK_VARIANTS(op_9XY0)
+QUIRK_VARIANTS(op_EX9E)
+QUIRK_VARIANTS(op_EXA1)
+QUIRK_VARIANTS(op_8XY1)
+QUIRK_VARIANTS(op_8XY2)
+QUIRK_VARIANTS(op_8XY3)
+QUIRK_VARIANTS(op_8XY6)
+QUIRK_VARIANTS(op_8XYE)
+QUIRK_VARIANTS(op_FX55)
+QUIRK_VARIANTS(op_FX65)
+QUIRK_VARIANTS(op_FX75)
+QUIRK_VARIANTS(op_FX85)
+QUIRK_VARIANTS(op_DXYN)
+
+#define QUIRK(op) (ext == CHIP8 ? op##_chip8 : ext == SUPERCHIP ? op##_superchip : op##_xochip)
+
+// fill out instruction format and pick the handler for it , with the quirks of ext
+ALWAYS_INLINE op_handler_t decode_instruction(uint16_t opcode, instruction_t * inst, extension_t ext){
+    inst->opcode = opcode;
+    inst->NNN = opcode & 0x0FFF;
+    inst->NN = opcode & 0x0FF;
+    inst->N = opcode & 0x0F;
+    inst->X = (opcode >> 8) & 0x0F;
+    inst->Y = (opcode >> 4) & 0x0F;
+
+    switch((opcode >> 12) & 0x0F){
+        case 0x0:
+            if(inst->NN == 0xE0) return op_00E0;
+            if(inst->NN == 0xEE) return op_00EE;
+            if(ext == CHIP8 || inst->X != 0) return op_nop; //unimplimented opcode  calling for machine code
+            if(inst->Y == 0xC) return op_00CN;
+            if(inst->Y == 0xD && ext == XOCHIP) return op_00DN;
+            switch(inst->NN){
+                case 0xFB: return op_00FB;
+                case 0xFC: return op_00FC;
+                case 0xFD: return op_00FD;
+                case 0xFE:
+                case 0xFF: return op_00FE;
+            }
+            return op_nop;
+        case 0x1: return op_1NNN;
+        case 0x2: return op_2NNN;
+        case 0x3: return QUIRK(op_3XNN);
+        case 0x4: return QUIRK(op_4XNN);
+        case 0x5:
+            if(inst->N == 0) return QUIRK(op_5XY0);
+            if(ext == XOCHIP && inst->N == 2) return op_5XY2;
+            if(ext == XOCHIP && inst->N == 3) return op_5XY3;
+            return op_nop; // wrong unimplimented rom opcode
+        case 0x6: return op_6XNN;
+        case 0x7: return op_7XNN;
+        case 0x8:
+            switch(inst->N){
+                case 0x0: return op_8XY0;
+                case 0x1: return QUIRK(op_8XY1);
+                case 0x2: return QUIRK(op_8XY2);
+                case 0x3: return QUIRK(op_8XY3);
+                case 0x4: return op_8XY4;
+                case 0x5: return op_8XY5;
+                case 0x6: return QUIRK(op_8XY6);
+                case 0x7: return op_8XY7;
+                case 0xE: return QUIRK(op_8XYE);
+                default: return op_nop;
+            }
+        case 0x9: return QUIRK(op_9XY0);
+        case 0xA: return op_ANNN;
+        case 0xB: return op_BNNN;
+        case 0xC: return op_CXNN;
+        case 0xD: return QUIRK(op_DXYN);
+        case 0xE:
+            if(inst->NN == 0x9E) return QUIRK(op_EX9E);
+            if(inst->NN == 0xA1) return QUIRK(op_EXA1);
+            return op_nop;
+        case 0xF:
+            switch(inst->NN){
+                case 0x00: return ext == XOCHIP && inst->X == 0 ? op_F000 : op_nop;
+                case 0x01: return ext == XOCHIP ? op_FN01 : op_nop;
+                case 0x02: return ext == XOCHIP && inst->X == 0 ? op_F002 : op_nop;
+                case 0x0A: return op_FX0A;
+                case 0x1E: return op_FX1E;
+                case 0x07: return op_FX07;
+                case 0x15: return op_FX15;
+                case 0x18: return op_FX18;
+                case 0x29: return op_FX29;
+                case 0x30: return ext != CHIP8 ? op_FX30 : op_nop;
+                case 0x33: return op_FX33;
+                case 0x3A: return ext == XOCHIP ? op_FX3A : op_nop;
+                case 0x55: return QUIRK(op_FX55);
+                case 0x65: return QUIRK(op_FX65);
+                case 0x75: return ext != CHIP8 ? QUIRK(op_FX75) : op_nop;
+                case 0x85: return ext != CHIP8 ? QUIRK(op_FX85) : op_nop;
+                default: return op_nop;
+            }
+    }
+    return op_nop;
+}
+
+// VIP machine cycles of an instruction , see VIP_CYCLES_PER_FRAME. sprites
+// and the register block copies pay by the byte , sprites are marked for the
+// display wait. worked out once per decode when there is a cache
+#define CYCLES_DRAW 0x8000
+
+ALWAYS_INLINE uint32_t cycle_cost(uint16_t opcode, extension_t ext){
+    static const uint8_t base[16] = { 23, 23, 23, 12, 12, 16, 6, 10, 44, 16, 12, 23, 36, 0, 16, 10 };
+    const uint32_t X = (opcode >> 8) & 0xF, Y = (opcode >> 4) & 0xF, N = opcode & 0xF;
+
+    switch(opcode >> 12){
+        case 0x0:
+            // super-chip scrolls move the whole screen , twice a clear
+            if(ext != CHIP8 && ((opcode & 0xFFE0) == 0x00C0 || opcode == 0x00FB || opcode == 0x00FC)) return 48;
+            break;
+        case 0x5:
+            if(ext == XOCHIP && (N == 2 || N == 3)) return 14 + 14 * ((X > Y ? X - Y : Y - X) + 1);
+            break;
+        case 0xD:
+            return (45 + 34 * (N == 0 && ext != CHIP8 ? 32 : N)) | CYCLES_DRAW;
+        case 0xF:
+            switch(opcode & 0xFF){
+                case 0x1E: return 19;
+                case 0x29: case 0x30: return 20;
+                case 0x33: return 204;
+                case 0x55: case 0x65: case 0x75: case 0x85: return 14 + 14 * (X + 1);
+            }
+            break;
+    }
+    return base[opcode >> 12];
+}
+
+// fresh entries decode themselves on first use , so dispatch never has to
+// check whether an entry is valid
+static void op_decode(chip8_t * chip8, const instruction_t * inst, const config_t * config){
+    (void)inst;
+    const uint16_t addr = (chip8->PC - 2) & 0xFFF;
+    decoded_t * entry = &chip8->decode_cache->entries[addr];
+    const uint16_t opcode = (chip8->ram[addr] << 8) | chip8->ram[(addr + 1) & 0xFFF];
+
+    entry->handler = decode_instruction(opcode, &entry->inst, chip8->decode_cache->extension);
+    chip8->decode_cache->cycles[addr] = cycle_cost(opcode, chip8->decode_cache->extension);
+    entry->handler(chip8, &entry->inst, config);
+}
+
+void attach_decode_cache(chip8_t * chip8, decode_cache_t * cache){
+    chip8->decode_cache = cache;
+    if(cache) invalidate_decode_cache(chip8, 0, sizeof(chip8->ram));
+}
+
+// cached handlers belong to one extension , start over when it changes
+static void retarget_decode_cache(chip8_t * chip8, extension_t ext){
+    chip8->decode_cache->extension = ext;
+    invalidate_decode_cache(chip8, 0, sizeof(chip8->ram));
+}
+
+void invalidate_decode_cache(chip8_t * chip8, uint16_t addr, uint32_t len){
+    decode_cache_t * cache = chip8->decode_cache;
+    if(!cache) return;
+
+    // the entry one byte before addr fetches its low byte from addr too
+    uint32_t start = addr ? addr - 1u : 0;
+    uint32_t end = (uint32_t) addr + len;
+    if(end > sizeof(cache->entries) / sizeof(cache->entries[0]))
+        end = sizeof(cache->entries) / sizeof(cache->entries[0]);
+
+    for(uint32_t i = start; i < end; i++) cache->entries[i].handler = op_decode;
+    // and the last entry fetches its low byte from 0
+    if(!addr && len) cache->entries[sizeof(cache->entries) / sizeof(cache->entries[0]) - 1].handler = op_decode;
+}
+
+void display_to_pixels(const uint64_t (*display)[DISPLAY_WORDS], uint32_t width, uint32_t on, uint32_t off,
+                       uint32_t * pixels, uint32_t first_row, uint32_t last_row){
+    const uint32_t diff = on ^ off;
+
+    for(uint32_t y = first_row; y <= last_row; y++){
+        uint32_t * out = pixels + y * DISPLAY_WIDTH;
+        for(uint32_t w = 0; w < width / 64; w++){
+            uint64_t row = display[y][w];
+            for(uint32_t x = 0; x < 64; x++, row <<= 1)
+                *out++ = off ^ (diff & -(uint32_t) (row >> 63)); // no branch per pixel
+        }
+    }
+}
+
+void planes_to_pixels(const uint64_t (*display)[DISPLAY_WORDS], const uint64_t (*display2)[DISPLAY_WORDS],
+                      uint32_t width, const uint32_t palette[4], uint32_t * pixels,
+                      uint32_t first_row, uint32_t last_row){
+    for(uint32_t y = first_row; y <= last_row; y++){
+        uint32_t * out = pixels + y * DISPLAY_WIDTH;
+        for(uint32_t w = 0; w < width / 64; w++){
+            uint64_t row = display[y][w], row2 = display2[y][w];
+            for(uint32_t x = 0; x < 64; x++, row <<= 1, row2 <<= 1)
+                *out++ = palette[(row >> 63) | (row2 >> 63) << 1];
+        }
+    }
+}
+
+uint64_t take_dirty_rows(chip8_t * chip8){
+    const uint64_t rows = chip8->dirty_rows;
+    chip8->dirty_rows = 0;
+    return rows;
+}
+
+void set_ram_write_hook(chip8_t * chip8, ram_write_hook_t hook, void * userdata){
+    chip8->write_hook = hook;
+    chip8->write_hook_data = userdata;
+}
+
+// ram_written for a range that stays inside ram
+static void mark_written(chip8_t * chip8, uint32_t addr, uint32_t len){
+    const uint32_t shift = chip8->xo_ram ? XO_RAM_PAGE_SHIFT : RAM_PAGE_SHIFT;
+    const uint32_t first_page = addr >> shift, last_page = (addr + len - 1) >> shift;
+    chip8->written_pages |= (uint32_t) ((2ull << last_page) - (1ull << first_page));
+    invalidate_decode_cache(chip8, addr, len);
+    if(chip8->write_hook) chip8->write_hook(chip8->write_hook_data, addr, len);
+}
+
+void ram_written(chip8_t * chip8, uint16_t addr, uint32_t len){
+    const uint32_t size = ram_size(chip8);
+    if(!len) return;
+    if(len > size) len = size;
+
+    // the handlers wrap their addresses at the end of ram , so does this : an
+    // address past it (I can grow to FFFF on a 4 KB machine) is taken modulo
+    // the size , and a range running past the end goes on at 0
+    addr &= size - 1;
+    if((uint32_t) addr + len > size){
+        mark_written(chip8, addr, size - addr);
+        mark_written(chip8, 0, addr + len - size);
+    }
+    else mark_written(chip8, addr, len);
+}
+
+// one instruction with the quirks of ext , always inlined with a constant ext
+// so each interpreter below is its own loop with no quirk tests left in it.
+// returns the instruction's cycle_cost , which only the cycle schedule looks at
+ALWAYS_INLINE uint32_t step(chip8_t * chip8, const config_t * config, extension_t ext){
+    const uint8_t * ram = memory(chip8, ext);
+    const uint32_t mask = memory_mask(chip8, ext);
+    PROFILE_INSTRUCTION((ram[chip8->PC & mask] << 8) | ram[(chip8->PC+1) & mask], chip8->PC);
+
+    // the cache only covers 4 KB
+    decode_cache_t * cache = ext == XOCHIP && chip8->xo_ram ? NULL : chip8->decode_cache;
+    if(cache){
+        if(cache->extension != ext) retarget_decode_cache(chip8, ext);
+
+        // decoded already (or op_decode) , a single indirect call
+        const uint32_t addr = chip8->PC & 0xFFF;
+        const decoded_t * entry = &cache->entries[addr];
+        chip8->PC +=2; // increment for next opcode
+        entry->handler(chip8, &entry->inst, config);
+        return cache->cycles[addr]; // op_decode has filled it in by now
+    }
+
+    instruction_t inst;
+    // PC wraps at 4K the same way the cache index does , or at 64K
+    const uint16_t opcode = (ram[chip8->PC & mask] << 8) | ram[(chip8->PC+1) & mask];
+    chip8->PC +=2; // increment for next opcode
+
+    decode_instruction(opcode, &inst, ext)(chip8, &inst, config);
+    return cycle_cost(opcode, ext);
+}
+
+ALWAYS_INLINE uint32_t run(chip8_t * chip8, const config_t * config, uint32_t count, extension_t ext){
+    chip8->idle_cycle = 0;
+
+    for(uint32_t i = 0; i < count; i++){
+        step(chip8, config, ext);
+
+        if(chip8->idle_cycle){
+            // PC is at the top of a loop that only repeats until the next
+            // tick or key change , land where running it out would have
+            const uint32_t skipped = count - i - 1;
+            chip8->PC += 2 * (skipped % chip8->idle_cycle);
+            return i + 1;
+        }
+    }
+    return count;
+}
+
+ALWAYS_INLINE uint32_t run_cycles_ext(chip8_t * chip8, const config_t * config, uint32_t cycles, extension_t ext){
+    chip8->idle_cycle = 0;
+    if(chip8->wait_vblank) return 0; // drew earlier in the frame
+    const uint32_t waits = config->display_wait ? CYCLES_DRAW : 0;
+    uint32_t spent = chip8->cycle_debt, count = 0;
+
+    while(spent < cycles){
+        const uint32_t cost = step(chip8, config, ext);
+        spent += cost & ~CYCLES_DRAW;
+        count++;
+
+        // waiting on a tick or a key , or on vblank to draw , burns the rest
+        if(chip8->idle_cycle || (cost & waits)){
+            chip8->wait_vblank = (cost & waits) != 0;
+            spent = cycles;
+            break;
+        }
+    }
+    chip8->cycle_debt = spent - cycles;
+    return count;
+}
+
+#define INTERPRETER(ext, name) \
+    static void step_##name(chip8_t * chip8, const config_t * config){ step(chip8, config, ext); } \
+    static uint32_t run_##name(chip8_t * chip8, const config_t * config, uint32_t count){ \
+        return run(chip8, config, count, ext); } \
+    static uint32_t run_cycles_##name(chip8_t * chip8, const config_t * config, uint32_t cycles){ \
+        return run_cycles_ext(chip8, config, cycles, ext); }
+
+INTERPRETER(CHIP8, chip8)
+INTERPRETER(SUPERCHIP, superchip)
+INTERPRETER(XOCHIP, xochip)
+
+static const interpreter_t interpreters[] = {
+    [CHIP8] = { step_chip8, run_chip8, run_cycles_chip8 },
+    [SUPERCHIP] = { step_superchip, run_superchip, run_cycles_superchip },
+    [XOCHIP] = { step_xochip, run_xochip, run_cycles_xochip },
+};
+
+const interpreter_t * select_interpreter(extension_t extension){
+    return &interpreters[extension];
+}
+
+//emulate chip8 instruction
+void emulate_instruction(chip8_t * chip8, const config_t * config){
+    interpreters[config->current_extension].step(chip8, config);
+}
+
+uint32_t run_instructions(chip8_t * chip8, const config_t * config, uint32_t count){
+    return interpreters[config->current_extension].run(chip8, config, count);
+}
+
+uint32_t run_cycles(chip8_t * chip8, const config_t * config, uint32_t cycles){
+    return interpreters[config->current_extension].run_cycles(chip8, config, cycles);
+}
+
+uint32_t display_hash(const chip8_t * chip8){
+    uint32_t hash = 2166136261u;
+    for(uint32_t y = 0; y < display_height(chip8); y++)
+        for(uint32_t x = 0; x < display_width(chip8); x++){
+            // plane bits , a classic display hashes the same as it always did
+            hash ^= display_pixel(chip8, x, y) | ((chip8->display2[y][x >> 6] >> (63 - (x & 63))) & 1) << 1;
+            hash *= 16777619u;
+        }
+    return hash;
+}
+
+bool update_timers(chip8_t *chip8){
+    chip8->wait_vblank = 0;
+    if(chip8->delay_timer > 0) chip8->delay_timer--;
+    if(chip8->sound_timer > 0){
+        chip8->sound_timer--;
+        return true;
+    }
+    return false; // dont play sound
+}
@@ -0,0 +1,270 @@
+#ifndef CHIP8_CORE_H
+#define CHIP8_CORE_H
+
+// the chip8 machine itself , no SDL in here so it can run headless
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {    // Emulator States
+    QUIT,
+    RUNNING,
+    PAUSE,
+} state_t;
+
+// what a program did that has no defined result. the machine stops (state
+// QUIT) with PC on the instruction , ram addresses on the other hand wrap
+// around the address space and are never a fault
+typedef enum {
+    FAULT_NONE,
+    FAULT_STACK_OVERFLOW,  // 2NNN with all 12 levels in use
+    FAULT_STACK_UNDERFLOW, // 00EE with nothing to return to
+    FAULT_BAD_KEY,         // EX9E / EXA1 on a VX above F
+} fault_t;
+
+// chip8-extension
+
+typedef enum {
+    CHIP8,
+    SUPERCHIP,
+    XOCHIP
+} extension_t;
+
+typedef struct{
+    uint32_t window_height;
+    uint32_t window_width;
+    uint32_t fg_color;
+    uint32_t bg_color;
+    uint32_t palette[4]; // xo-chip colors by plane bits : off , plane 1 , plane 2 , both
+    uint32_t scale_factor; //  amount to scale a pixel to 20x
+    bool pixel_outlines;
+    uint32_t inst_per_second; // instructions per second  (clock rate ) , 0 = uncapped
+    uint32_t cycles_per_frame; // 0 = every instruction costs the same , inst_per_second of them. else a
+                               // frame spends this many cycles of the cost table (VIP_CYCLES_PER_FRAME)
+    bool display_wait; // with cycles_per_frame , DXYN waits for vblank like the VIP , one draw a frame
+    uint32_t turbo_factor; // speed multiplier while turbo is on
+    bool show_stats; // print measured speed and timer drift every second
+    uint32_t square_wave_freq;  // frequency of square sound
+    uint32_t audio_sample_rate;
+    uint16_t volume; // how loud or not is the sound
+    extension_t current_extension; // current quirks/extension support
+    uint32_t rewind_bytes; // rewind history kept by the front end , 0 = none
+    uint32_t seed; // CXNN seed of the front end , 0 = from the clock
+    const char * movie_path; // front end records its input here , NULL = not at all
+    const char * video_path; // front end records its frames here , NULL = not at all
+    const char * trace_path; // and every instruction here
+} config_t;
+
+
+typedef struct{
+    uint16_t opcode;
+    uint16_t NNN; // 12bit address
+    uint8_t NN;   //8 bit constant
+    uint8_t N;     // 4 bit constant
+    uint8_t X;      // register
+    uint8_t Y;      // register
+} instruction_t;
+
+
+// the framebuffer is super-chip hires , 128x64 as two 64 bit words per row.
+// lores (64x32) uses word 0 of the first 32 rows , the same layout chip8 always had
+#define DISPLAY_WIDTH 128
+#define DISPLAY_HEIGHT 64
+#define DISPLAY_WORDS (DISPLAY_WIDTH / 64)
+#define LORES_WIDTH 64
+#define LORES_HEIGHT 32
+
+typedef struct chip8 chip8_t;
+
+// one opcode handler , PC already points past the opcode when it runs
+typedef void (*op_handler_t)(chip8_t * chip8, const instruction_t * inst, const config_t * config);
+
+// pre-decoded instruction , one per ram address since jumps can land on odd ones
+typedef struct{
+    op_handler_t handler;
+    instruction_t inst;
+} decoded_t;
+
+typedef struct{
+    decoded_t entries[4096];
+    uint16_t cycles[4096]; // each entry's cost on the cycle schedule , filled in with it
+    extension_t extension; // quirks the entries were decoded with
+} decode_cache_t;
+
+// ram writes are tracked per page , see written_pages. xo-chip's 64 KB go
+// in bigger pages so they fit the same 32 bits
+#define RAM_PAGE_SHIFT 8
+#define RAM_PAGE_SIZE (1u << RAM_PAGE_SHIFT)
+#define RAM_PAGES (4096 >> RAM_PAGE_SHIFT)
+#define XO_RAM_SIZE 0x10000
+#define XO_RAM_PAGE_SHIFT 11
+
+struct fork_pages;
+
+// told about every program write to ram[addr .. addr+len) , never past the end of ram
+typedef void (*ram_write_hook_t)(void * userdata, uint16_t addr, uint32_t len);
+
+struct chip8{
+    uint8_t ram[4096]; // classic memory , unused once xo_ram is attached
+    uint64_t display[DISPLAY_HEIGHT][DISPLAY_WORDS];  // packed rows , bit 63 of word 0 is x = 0
+    uint64_t display2[DISPLAY_HEIGHT][DISPLAY_WORDS]; // xo-chip second bit plane , same layout
+    uint8_t planes; // xo-chip FN01 , bit per plane drawn , scrolled and cleared , 1 = display only
+    uint64_t dirty_rows; // bit per display row changed since the last take_dirty_rows
+    bool hires; // super-chip 00FF , 128x64 until 00FE
+    state_t state;
+    uint8_t fault; // fault_t , why the program was stopped
+    uint16_t stack[12]; // for tweleve nesting states
+    uint8_t SP; // stack pointer , stack[SP] is the next free slot
+    uint8_t V[16]; // for all registers
+    uint8_t flags[16]; // super-chip FX75 / FX85 user flags
+    uint16_t I; //index register for the address
+    uint16_t PC; // program counter
+    uint8_t delay_timer; // Decrements at 60hz when >0
+    uint8_t sound_timer;  // Decrements at 60hz and plays tone when > 0
+    bool keypads[16]; //keypads
+    uint8_t wait_key; // key FX0A saw go down and waits to come up , 0xFF = none yet
+    uint8_t wait_vblank; // drew under display_wait , run_cycles runs nothing until update_timers
+    uint16_t keys_read; // keys EX9E , EXA1 and FX0A looked at , bit per key , only set here , the front end clears it
+    uint8_t idle_cycle; // instructions in the wait loop the program is spinning in , 0 = busy
+    uint32_t cycle_debt; // cycles the last instruction of the frame before ran past its budget
+    uint32_t rng; // xorshift32 state CXNN draws from , never 0
+    uint8_t audio_pattern[16]; // xo-chip F002 , 128 one bit samples played while the sound timer runs
+    uint8_t pitch; // xo-chip FX3A , the pattern plays at 4000 * 2^((pitch - 64) / 48) bits per second
+    bool pattern_loaded; // F002 ran , the pattern replaces the square tone
+    const char * rom_name; // rom name
+    decode_cache_t * decode_cache; // optional , NULL decodes every instruction
+    ram_write_hook_t write_hook; // optional , e.g. the jit dropping stale blocks
+    void * write_hook_data;
+    uint32_t written_pages; // bit per ram page written since it was last cleared
+    struct fork_pages * ram_base; // shared copy the unwritten pages still match , see chip8_fork.h
+    uint8_t * xo_ram; // optional XO_RAM_SIZE bytes , the xo-chip address space , see attach_xo_ram
+};
+
+// everything above apart from the attachments (decode_cache , write_hook ,
+// ram_base , xo_ram , rom_name) is plain data , a machine can be copied with memcpy
+
+// the memory programs see , 4 KB or the attached 64 KB. like strchr it hands
+// back a writable pointer for a const machine
+static inline uint8_t * chip8_ram(const chip8_t * chip8){
+    return chip8->xo_ram ? chip8->xo_ram : (uint8_t *) chip8->ram;
+}
+
+static inline uint32_t ram_size(const chip8_t * chip8){
+    return chip8->xo_ram ? XO_RAM_SIZE : sizeof(chip8->ram);
+}
+
+
+static inline uint32_t display_width(const chip8_t * chip8){
+    return chip8->hires ? DISPLAY_WIDTH : LORES_WIDTH;
+}
+
+static inline uint32_t display_height(const chip8_t * chip8){
+    return chip8->hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+}
+
+static inline bool display_pixel(const chip8_t * chip8, uint32_t x, uint32_t y){
+    return (chip8->display[y][x >> 6] >> (63 - (x & 63))) & 1;
+}
+
+// default machine + display settings
+void init_config(config_t * config);
+
+// "chip8" , "schip" or "xochip" , false (and a message) for anything else
+bool parse_extension(const char * name, extension_t * extension);
+const char * extension_name(extension_t extension);
+const char * fault_name(fault_t fault);
+
+// 32 bit xorshift , a fast generator for anything that has to replay exactly
+static inline uint32_t xorshift32(uint32_t * state){
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// load font and rom , false if the rom can't be loaded. CXNN starts from seed 1
+bool init_chip8(chip8_t * chip8, const char rom_name []);
+
+// same with a rom image already in memory , rom_name is only kept for reports
+bool init_chip8_image(chip8_t * chip8, const uint8_t * image, size_t size, const char rom_name []);
+
+// restart the CXNN random numbers , the same seed gives the same numbers
+void seed_chip8(chip8_t * chip8, uint32_t seed);
+
+// give the machine the 64 KB xo-chip address space (XO_RAM_SIZE bytes , owned by
+// the caller) , or NULL for the classic 4 KB. call before loading a rom , which
+// then may be up to 64 KB - 0x200. only for machines run as xo-chip , without it
+// xo-chip programs run in 4 KB
+void attach_xo_ram(chip8_t * chip8, uint8_t * ram);
+
+// start using a decode cache (or stop with NULL) , the cache is cleared.
+// it covers 4 KB , xo-chip machines with xo_ram decode every instruction
+void attach_decode_cache(chip8_t * chip8, decode_cache_t * cache);
+
+// throw away decoded instructions overlapping ram[addr .. addr+len)
+void invalidate_decode_cache(chip8_t * chip8, uint16_t addr, uint32_t len);
+
+// expand the first width pixels of display rows first_row..last_row into one
+// 32 bit color per pixel , written at pixels + first_row * DISPLAY_WIDTH with
+// rows DISPLAY_WIDTH apart whatever width is
+void display_to_pixels(const uint64_t (*display)[DISPLAY_WORDS], uint32_t width, uint32_t on, uint32_t off,
+                       uint32_t * pixels, uint32_t first_row, uint32_t last_row);
+
+// same with both xo-chip planes , each pixel's two plane bits pick its color
+// from palette (off , plane 1 , plane 2 , both)
+void planes_to_pixels(const uint64_t (*display)[DISPLAY_WORDS], const uint64_t (*display2)[DISPLAY_WORDS],
+                      uint32_t width, const uint32_t palette[4], uint32_t * pixels,
+                      uint32_t first_row, uint32_t last_row);
+
+// rows changed since the last call (0 = nothing to redraw) , and start over
+uint64_t take_dirty_rows(chip8_t * chip8);
+
+// only one hook at a time , NULL removes it
+void set_ram_write_hook(chip8_t * chip8, ram_write_hook_t hook, void * userdata);
+
+// ram[addr .. addr+len) changed , drops decoded instructions and calls the hook.
+// addresses wrap around the end of ram like the handlers' , the hook gets a
+// range that wraps as its two parts
+void ram_written(chip8_t * chip8, uint16_t addr, uint32_t len);
+
+// interpreter built for one extension , its quirks are resolved at compile
+// time. pick it once with select_interpreter and call through it in hot loops
+typedef struct{
+    void (*step)(chip8_t * chip8, const config_t * config); // emulate_instruction
+    uint32_t (*run)(chip8_t * chip8, const config_t * config, uint32_t count); // run_instructions
+    uint32_t (*run_cycles)(chip8_t * chip8, const config_t * config, uint32_t cycles); // run_cycles
+} interpreter_t;
+
+const interpreter_t * select_interpreter(extension_t extension);
+
+//emulate one chip8 instruction , picks the interpreter for config's extension every call
+void emulate_instruction(chip8_t * chip8, const config_t * config);
+
+// run count instructions , but stop as soon as the program is only waiting for
+// the next timer tick or a key (delay timer polling loop , FX0A , jump to self).
+// the rest of the slice is skipped with the machine left exactly where
+// running it would have left it. returns instructions really executed ,
+// idle_cycle says whether it went idle
+uint32_t run_instructions(chip8_t * chip8, const config_t * config, uint32_t count);
+
+// the cycle schedule : run until cycles of the cost table are spent , the
+// instruction crossing the line still runs and the next call pays for it (see
+// cycle_debt). a program that is only waiting is done for the call , with
+// display_wait one that drew is done until the next update_timers , so a frame
+// can be run in several calls. returns instructions executed
+uint32_t run_cycles(chip8_t * chip8, const config_t * config, uint32_t cycles);
+
+// machine cycles the COSMAC VIP gets through in a 60hz frame , 1.76 MHz at 8
+// clocks a cycle. the cost table is in these , estimated from the VIP
+// interpreter , with the super-chip and xo-chip opcodes priced alike
+#define VIP_CYCLES_PER_FRAME 3668
+
+// fnv-1a over the pixels of the current resolution , for comparing runs
+uint32_t display_hash(const chip8_t * chip8);
+
+// 60hz tick , returns true while the sound timer is active (tone should play)
+bool update_timers(chip8_t * chip8);
+
+#endif
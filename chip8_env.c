@@ -0,0 +1,266 @@
+// chip8-env , serves one machine to another process through shared memory ,
+// see chip8_env.h for the protocol
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "chip8_core.h"
+#include "chip8_env.h"
+#include "chip8_fork.h"
+#include "chip8_movie.h"
+
+_Static_assert(sizeof(((env_observation_t *) 0)->display) == sizeof(((chip8_t *) 0)->display), "observation display size");
+_Static_assert(sizeof(((env_observation_t *) 0)->ram) == sizeof(((chip8_t *) 0)->ram), "observation ram size");
+_Static_assert(sizeof(((env_observation_t *) 0)->stack) == sizeof(((chip8_t *) 0)->stack), "observation stack size");
+
+// an empty ring is polled flat out for this many rounds , then with a yield
+// in between (a client on the same core gets to run) , then with a sleep once
+// the client has gone quiet for a while
+#define SPIN_ROUNDS (1u << 10)
+#define YIELD_ROUNDS (1u << 16)
+#define IDLE_SLEEP_NS 100000
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() ((void) 0)
+#endif
+
+typedef struct{
+    chip8_t chip8;
+    config_t config;
+    const interpreter_t * interpreter;
+    fork_pool_t * pool;
+    fork_t * start;               // the machine right after loading , what a reset goes back to
+    fork_t * slots[ENV_SLOTS];
+    uint32_t seed;
+    uint32_t inst_acc;            // frame_budget remainder
+    uint64_t frames;
+    uint64_t instructions;
+    uint64_t dirty_rows;          // drawn to since the last publish
+} server_t;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig){
+    (void)sig;
+    stop = 1;
+}
+
+static void usage(const char * prog){
+    fprintf(stderr,
+        "Usage %s [options] <rom_name>\n"
+        "  -n S   shared memory name (default " ENV_DEFAULT_NAME ")\n"
+        "  -c N   instructions per second of the emulated clock (default 700)\n"
+        "  -V     COSMAC VIP timing , VIP cycles per opcode and DXYN waits a frame\n"
+        "  -e S   quirks of chip8 , schip or xochip (default chip8)\n"
+        "  -s N   seed for CXNN random numbers , ENV_RESET 0 goes back to it (default 1)\n",
+        prog);
+}
+
+// the next command past done , or the current tail when asked to stop
+static uint32_t wait_for_command(env_region_t * env, uint32_t done){
+    for(uint32_t idle = 0;; idle++){
+        const uint32_t tail = atomic_load_explicit(&env->tail, memory_order_acquire);
+        if(tail != done || stop) return tail;
+
+        if(idle < SPIN_ROUNDS) cpu_relax();
+        else if(idle < SPIN_ROUNDS + YIELD_ROUNDS) sched_yield();
+        else {
+            const struct timespec nap = { .tv_nsec = IDLE_SLEEP_NS };
+            nanosleep(&nap, NULL);
+            idle = SPIN_ROUNDS + YIELD_ROUNDS; // and don't wrap back to spinning
+        }
+    }
+}
+
+// the same frame schedule as the front end and the movies
+static void step_frames(server_t * server, uint32_t frames){
+    chip8_t * chip8 = &server->chip8;
+    for(uint32_t f = 0; f < frames && chip8->state != QUIT; f++){
+        server->instructions += run_frame(server->interpreter, chip8, &server->config, &server->inst_acc);
+        update_timers(chip8);
+        server->frames++;
+        server->dirty_rows |= take_dirty_rows(chip8);
+    }
+}
+
+static env_status_t run_command(server_t * server, const env_command_t * command){
+    chip8_t * chip8 = &server->chip8;
+
+    switch(command->op){
+        case ENV_STEP:
+            step_frames(server, command->arg);
+            return ENV_OK;
+        case ENV_KEYS:
+            for(uint8_t i = 0; i < 16; i++) chip8->keypads[i] = (command->mask >> i) & 1;
+            return ENV_OK;
+        case ENV_RESET:
+            fork_restore(server->pool, chip8, server->start);
+            seed_chip8(chip8, command->arg ? command->arg : server->seed);
+            server->inst_acc = 0;
+            server->frames = 0;
+            server->instructions = 0;
+            server->dirty_rows = ~0ull;
+            return ENV_OK;
+        case ENV_SAVE: {
+            if(command->arg >= ENV_SLOTS) return ENV_BAD_COMMAND;
+            fork_t * fork = fork_clone(server->pool, chip8);
+            if(!fork) return ENV_NO_MEMORY;
+            fork_release(server->pool, server->slots[command->arg]);
+            server->slots[command->arg] = fork;
+            return ENV_OK;
+        }
+        case ENV_LOAD:
+            if(command->arg >= ENV_SLOTS) return ENV_BAD_COMMAND;
+            if(!server->slots[command->arg]) return ENV_NO_SNAPSHOT;
+            fork_restore(server->pool, chip8, server->slots[command->arg]);
+            server->dirty_rows = ~0ull;
+            return ENV_OK;
+        case ENV_QUIT:
+            stop = 1;
+            return ENV_OK;
+        default:
+            return ENV_BAD_COMMAND;
+    }
+}
+
+// the machine into the observation , before done moves on
+static void publish(server_t * server, env_observation_t * obs){
+    const chip8_t * chip8 = &server->chip8;
+    obs->frames = server->frames;
+    obs->instructions = server->instructions;
+    memcpy(obs->display, chip8->display, sizeof(obs->display));
+    memcpy(obs->display2, chip8->display2, sizeof(obs->display2));
+    obs->dirty_rows = server->dirty_rows;
+    memcpy(obs->ram, chip8->ram, sizeof(obs->ram));
+    memcpy(obs->stack, chip8->stack, sizeof(obs->stack));
+    memcpy(obs->V, chip8->V, sizeof(obs->V));
+    memcpy(obs->flags, chip8->flags, sizeof(obs->flags));
+    obs->I = chip8->I;
+    obs->PC = chip8->PC;
+    obs->SP = chip8->SP;
+    obs->delay_timer = chip8->delay_timer;
+    obs->sound_timer = chip8->sound_timer;
+    obs->hires = chip8->hires;
+    obs->halted = chip8->state == QUIT;
+    obs->fault = chip8->fault;
+    // a pixel at a time , only worth it when something was drawn
+    if(server->dirty_rows) obs->display_hash = display_hash(chip8);
+    server->dirty_rows = 0;
+}
+
+int main(int argc, char ** argv){
+    static server_t server;
+    init_config(&server.config);
+    server.seed = 1;
+    const char * name = ENV_DEFAULT_NAME;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:c:Ve:s:")) != -1){
+        switch(opt){
+            case 'n': name = optarg; break;
+            case 'c': server.config.inst_per_second = strtoul(optarg, NULL, 0); break;
+            case 'V':
+                server.config.cycles_per_frame = VIP_CYCLES_PER_FRAME;
+                server.config.display_wait = true;
+                break;
+            case 'e':
+                if(!parse_extension(optarg, &server.config.current_extension)) return EXIT_FAILURE;
+                break;
+            case 's': server.seed = strtoul(optarg, NULL, 0); break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if(optind >= argc || server.config.inst_per_second < 60){
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // xo-chip programs run in 4 KB , so every state fits a fork and the observation
+    chip8_t * chip8 = &server.chip8;
+    if(!init_chip8(chip8, argv[optind])) return EXIT_FAILURE;
+    static decode_cache_t decode_cache;
+    attach_decode_cache(chip8, &decode_cache);
+    seed_chip8(chip8, server.seed);
+    server.interpreter = select_interpreter(server.config.current_extension);
+
+    server.pool = fork_pool_create();
+    server.start = server.pool ? fork_clone(server.pool, chip8) : NULL;
+    if(!server.start){
+        fprintf(stderr, "Out of memory for the reset snapshot\n");
+        return EXIT_FAILURE;
+    }
+
+    const int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if(fd < 0 || ftruncate(fd, sizeof(env_region_t)) != 0){
+        fprintf(stderr, "Could not create shared memory %s\n", name);
+        if(fd >= 0) shm_unlink(name);
+        return EXIT_FAILURE;
+    }
+    env_region_t * env = mmap(NULL, sizeof(env_region_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(env == MAP_FAILED){
+        fprintf(stderr, "Could not map shared memory %s\n", name);
+        shm_unlink(name);
+        return EXIT_FAILURE;
+    }
+
+    // a region left over from an earlier server starts over
+    memset(env, 0, sizeof(*env));
+    env->magic = ENV_MAGIC;
+    env->version = ENV_VERSION;
+    env->size = sizeof(env_region_t);
+    env->inst_per_second = server.config.inst_per_second;
+    env->extension = server.config.current_extension;
+    env->seed = server.seed;
+    env->cycles_per_frame = server.config.cycles_per_frame;
+    env->display_wait = server.config.display_wait;
+    server.dirty_rows = take_dirty_rows(chip8);
+    publish(&server, &env->observation);
+    atomic_store_explicit(&env->ready, 1, memory_order_release);
+
+    struct sigaction action = { .sa_handler = on_signal };
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    printf("serving %s on %s (%s , %u inst/sec)\n", chip8->rom_name, name,
+           extension_name(server.config.current_extension), server.config.inst_per_second);
+    fflush(stdout);
+
+    // the ring is only ours from done to tail , one command at a time so a
+    // client waiting on an early one sees it as soon as it's finished
+    uint32_t done = 0;
+    while(!stop){
+        const uint32_t tail = wait_for_command(env, done);
+        for(; done != tail && !stop; done++){
+            env_command_t * command = &env->commands[done & (ENV_COMMANDS - 1)];
+            command->status = run_command(&server, command);
+            publish(&server, &env->observation);
+            atomic_store_explicit(&env->done, done + 1, memory_order_release);
+        }
+    }
+
+    atomic_store_explicit(&env->ready, 0, memory_order_release);
+    munmap(env, sizeof(env_region_t));
+    shm_unlink(name);
+
+    for(uint32_t i = 0; i < ENV_SLOTS; i++) fork_release(server.pool, server.slots[i]);
+    fork_release(server.pool, server.start);
+    fork_detach(server.pool, chip8);
+    fork_pool_destroy(server.pool);
+    return EXIT_SUCCESS;
+}
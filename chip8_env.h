@@ -0,0 +1,129 @@
+#ifndef CHIP8_ENV_H
+#define CHIP8_ENV_H
+
+// shared memory interface of chip8-env , for agents driving the emulator from
+// another process
+//
+// the server maps one POSIX shared memory object holding a command ring and
+// the latest observation. the client pushes commands into the ring (single
+// producer , single consumer , no locks) and the server runs them in order ,
+// then publishes how many it finished. the observation is only written while
+// a command runs , so once done reaches a command the client reads it in
+// place , with no copies , serialization or sockets. both sides poll while
+// they're busy , so with a core each a step costs the emulation plus well
+// under a microsecond of handover , sharing one core it's a yield.
+//
+// this header is the whole protocol , it only needs a C compiler (or ctypes)
+// on the client side
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+#define ENV_DEFAULT_NAME "/chip8-env"
+#define ENV_MAGIC 0x38504843u // "CHP8"
+#define ENV_VERSION 2
+#define ENV_COMMANDS 64 // ring slots , a power of two
+#define ENV_SLOTS 16    // snapshots the server holds
+#define ENV_SPIN 1024   // polls of done before a waiting client starts yielding
+
+typedef enum{
+    ENV_STEP,     // run arg frames with the keys held , timers tick once per frame
+    ENV_KEYS,     // hold the keys of mask (bit per key) from now on
+    ENV_RESET,    // back to the loaded rom , CXNN seeded with arg (0 = the server's seed)
+    ENV_SAVE,     // snapshot into slot arg
+    ENV_LOAD,     // back to the snapshot in slot arg
+    ENV_QUIT,     // the server unmaps the region and exits
+} env_op_t;
+
+typedef enum{
+    ENV_OK,
+    ENV_BAD_COMMAND, // unknown op , or a slot out of range
+    ENV_NO_SNAPSHOT, // ENV_LOAD of an empty slot
+    ENV_NO_MEMORY,
+} env_status_t;
+
+typedef struct{
+    uint32_t op;     // env_op_t
+    uint32_t arg;
+    uint32_t mask;   // ENV_KEYS
+    uint32_t status; // env_status_t , written by the server before done passes the command
+} env_command_t;
+
+// the machine after the last finished command
+typedef struct{
+    uint64_t frames;        // frames since the last reset
+    uint64_t instructions;  // instructions run since the last reset , waits skipped over don't count
+    uint64_t display[64][2];  // packed rows , bit 63 of word 0 is x = 0 , lores is the top left 64x32
+    uint64_t display2[64][2]; // xo-chip second plane , same layout
+    uint64_t dirty_rows;    // rows drawn to by the last command
+    uint8_t ram[4096];
+    uint16_t stack[12];
+    uint8_t V[16];
+    uint8_t flags[16];
+    uint16_t I;
+    uint16_t PC;
+    uint8_t SP;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t hires;
+    uint8_t halted;         // 00FD ran or a fault , only a reset or load brings it back
+    uint8_t fault;          // fault_t , why it halted
+    uint8_t unused[2];
+    uint32_t display_hash;
+} env_observation_t;
+
+typedef struct{
+    // filled in before ready is set
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;          // bytes of the region
+    uint32_t inst_per_second;
+    uint32_t extension;     // extension_t
+    uint32_t seed;
+    uint32_t cycles_per_frame; // 0 = frames run inst_per_second / 60 instructions
+    uint32_t display_wait;
+    atomic_uint ready;      // the server is running commands
+
+    // the client only writes tail and the slots from done to tail , the
+    // server only done , the statuses and the observation. each on its own
+    // cache line
+    _Alignas(64) atomic_uint tail;     // commands pushed
+    _Alignas(64) atomic_uint done;     // commands finished , their slots and the observation are the client's
+    _Alignas(64) env_command_t commands[ENV_COMMANDS];
+    _Alignas(64) env_observation_t observation;
+} env_region_t;
+
+// client side : queue a command , false when the ring is full. returns its
+// number in *seq , it's finished once env_done passes it
+static inline bool env_push(env_region_t * env, env_op_t op, uint32_t arg, uint32_t mask, uint32_t * seq){
+    const uint32_t tail = atomic_load_explicit(&env->tail, memory_order_relaxed);
+    if(tail - atomic_load_explicit(&env->done, memory_order_acquire) == ENV_COMMANDS) return false;
+
+    env->commands[tail & (ENV_COMMANDS - 1)] = (env_command_t){ .op = op, .arg = arg, .mask = mask };
+    atomic_store_explicit(&env->tail, tail + 1, memory_order_release);
+    *seq = tail;
+    return true;
+}
+
+static inline bool env_done(env_region_t * env, uint32_t seq){
+    return (int32_t) (atomic_load_explicit(&env->done, memory_order_acquire) - seq) > 0;
+}
+
+// spin until command seq finished , returns its status. after ENV_SPIN
+// polls the cpu is given up between them , the server may need it
+static inline env_status_t env_wait(env_region_t * env, uint32_t seq){
+    for(uint32_t polls = 0; !env_done(env, seq); polls++)
+        if(polls >= ENV_SPIN) sched_yield();
+    return env->commands[seq & (ENV_COMMANDS - 1)].status;
+}
+
+// push and wait , the usual way to drive the server one command at a time
+static inline env_status_t env_call(env_region_t * env, env_op_t op, uint32_t arg, uint32_t mask){
+    uint32_t seq;
+    while(!env_push(env, op, arg, mask, &seq));
+    return env_wait(env, seq);
+}
+
+#endif
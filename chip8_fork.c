@@ -0,0 +1,266 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_fork.h"
+
+#define SLAB_OBJECTS 256
+#define SLAB_ALIGN 64
+
+// free list allocator for one object size , slabs are only given back when
+// the pool is destroyed
+typedef struct slab{
+    struct slab * next;
+} slab_t;
+
+typedef struct{
+    size_t size;   // object size rounded up to SLAB_ALIGN
+    void * free;   // freed objects , linked through their first bytes
+    slab_t * slabs;
+    uint32_t live;
+} object_pool_t;
+
+typedef struct{
+    uint8_t bytes[RAM_PAGE_SIZE];
+    uint32_t refs; // page tables holding it
+} page_t;
+
+struct fork_pages{
+    page_t * pages[RAM_PAGES];
+    uint32_t refs; // forks and machines holding it
+};
+
+struct fork{
+    uint64_t display[DISPLAY_HEIGHT][DISPLAY_WORDS];
+    uint64_t display2[DISPLAY_HEIGHT][DISPLAY_WORDS];
+    uint8_t planes;
+    uint16_t stack[12];
+    uint8_t V[16];
+    uint8_t flags[16];
+    bool keypads[16];
+    uint16_t I;
+    uint16_t PC;
+    uint8_t SP;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t wait_key;
+    uint32_t rng;
+    uint32_t cycle_debt;
+    uint8_t wait_vblank;
+    uint8_t audio_pattern[16];
+    uint8_t pitch;
+    bool pattern_loaded;
+    bool hires;
+    state_t state;
+    uint8_t fault;
+    struct fork_pages * ram;
+};
+
+struct fork_pool{
+    object_pool_t forks;
+    object_pool_t tables;
+    object_pool_t pages;
+};
+
+static void init_objects(object_pool_t * objects, size_t size){
+    objects->size = (size + SLAB_ALIGN - 1) & ~(size_t) (SLAB_ALIGN - 1);
+}
+
+static void * alloc_object(object_pool_t * objects){
+    if(!objects->free){
+        // the slab header takes the first SLAB_ALIGN bytes so objects stay aligned
+        uint8_t * slab = aligned_alloc(SLAB_ALIGN, SLAB_ALIGN + SLAB_OBJECTS * objects->size);
+        if(!slab) return NULL;
+        ((slab_t *) slab)->next = objects->slabs;
+        objects->slabs = (slab_t *) slab;
+
+        for(uint32_t i = SLAB_OBJECTS; i-- > 0;){
+            void * object = slab + SLAB_ALIGN + i * objects->size;
+            *(void **) object = objects->free;
+            objects->free = object;
+        }
+    }
+
+    void * object = objects->free;
+    objects->free = *(void **) object;
+    objects->live++;
+    return object;
+}
+
+static void free_object(object_pool_t * objects, void * object){
+    *(void **) object = objects->free;
+    objects->free = object;
+    objects->live--;
+}
+
+static void destroy_objects(object_pool_t * objects){
+    while(objects->slabs){
+        slab_t * next = objects->slabs->next;
+        free(objects->slabs);
+        objects->slabs = next;
+    }
+}
+
+fork_pool_t * fork_pool_create(void){
+    fork_pool_t * pool = calloc(1, sizeof(*pool));
+    if(!pool) return NULL;
+    init_objects(&pool->forks, sizeof(fork_t));
+    init_objects(&pool->tables, sizeof(struct fork_pages));
+    init_objects(&pool->pages, sizeof(page_t));
+    return pool;
+}
+
+void fork_pool_destroy(fork_pool_t * pool){
+    if(!pool) return;
+    destroy_objects(&pool->forks);
+    destroy_objects(&pool->tables);
+    destroy_objects(&pool->pages);
+    free(pool);
+}
+
+static void release_pages(fork_pool_t * pool, struct fork_pages * table){
+    if(--table->refs) return;
+    for(uint32_t p = 0; p < RAM_PAGES; p++){
+        page_t * page = table->pages[p];
+        if(page && !--page->refs) free_object(&pool->pages, page);
+    }
+    free_object(&pool->tables, table);
+}
+
+// page table of the machine's ram , sharing the pages it hasn't written with
+// its base. NULL when out of memory
+static struct fork_pages * share_pages(fork_pool_t * pool, const chip8_t * chip8){
+    struct fork_pages * base = chip8->ram_base;
+    if(base && !chip8->written_pages){
+        base->refs++;
+        return base;
+    }
+
+    struct fork_pages * table = alloc_object(&pool->tables);
+    if(!table) return NULL;
+    memset(table->pages, 0, sizeof(table->pages));
+    table->refs = 1;
+
+    for(uint32_t p = 0; p < RAM_PAGES; p++){
+        if(base && !((chip8->written_pages >> p) & 1)){
+            table->pages[p] = base->pages[p];
+            table->pages[p]->refs++;
+            continue;
+        }
+
+        page_t * page = alloc_object(&pool->pages);
+        if(!page){
+            release_pages(pool, table);
+            return NULL;
+        }
+        memcpy(page->bytes, &chip8->ram[p * RAM_PAGE_SIZE], RAM_PAGE_SIZE);
+        page->refs = 1;
+        table->pages[p] = page;
+    }
+    return table;
+}
+
+// from now on the machine's unwritten pages are the ones of table
+static void rebase(fork_pool_t * pool, chip8_t * chip8, struct fork_pages * table){
+    table->refs++;
+    if(chip8->ram_base) release_pages(pool, chip8->ram_base);
+    chip8->ram_base = table;
+    chip8->written_pages = 0;
+}
+
+fork_t * fork_clone(fork_pool_t * pool, chip8_t * chip8){
+    if(chip8->xo_ram) return NULL;
+
+    fork_t * fork = alloc_object(&pool->forks);
+    if(!fork) return NULL;
+
+    fork->ram = share_pages(pool, chip8);
+    if(!fork->ram){
+        free_object(&pool->forks, fork);
+        return NULL;
+    }
+    if(fork->ram != chip8->ram_base) rebase(pool, chip8, fork->ram);
+
+    memcpy(fork->display, chip8->display, sizeof(fork->display));
+    memcpy(fork->display2, chip8->display2, sizeof(fork->display2));
+    fork->planes = chip8->planes;
+    memcpy(fork->stack, chip8->stack, sizeof(fork->stack));
+    memcpy(fork->V, chip8->V, sizeof(fork->V));
+    memcpy(fork->flags, chip8->flags, sizeof(fork->flags));
+    fork->hires = chip8->hires;
+    memcpy(fork->keypads, chip8->keypads, sizeof(fork->keypads));
+    fork->I = chip8->I;
+    fork->PC = chip8->PC;
+    fork->SP = chip8->SP;
+    fork->delay_timer = chip8->delay_timer;
+    fork->sound_timer = chip8->sound_timer;
+    fork->wait_key = chip8->wait_key;
+    fork->rng = chip8->rng;
+    fork->cycle_debt = chip8->cycle_debt;
+    fork->wait_vblank = chip8->wait_vblank;
+    memcpy(fork->audio_pattern, chip8->audio_pattern, sizeof(fork->audio_pattern));
+    fork->pitch = chip8->pitch;
+    fork->pattern_loaded = chip8->pattern_loaded;
+    fork->state = chip8->state;
+    fork->fault = chip8->fault;
+    return fork;
+}
+
+void fork_restore(fork_pool_t * pool, chip8_t * chip8, fork_t * fork){
+    const struct fork_pages * base = chip8->ram_base;
+    const struct fork_pages * table = fork->ram;
+
+    if(base != table || chip8->written_pages){
+        for(uint32_t p = 0; p < RAM_PAGES; p++){
+            if(base && base->pages[p] == table->pages[p] && !((chip8->written_pages >> p) & 1)) continue;
+            memcpy(&chip8->ram[p * RAM_PAGE_SIZE], table->pages[p]->bytes, RAM_PAGE_SIZE);
+            ram_written(chip8, p * RAM_PAGE_SIZE, RAM_PAGE_SIZE);
+        }
+        rebase(pool, chip8, fork->ram);
+    }
+
+    if(chip8->hires != fork->hires) chip8->dirty_rows = ~0ull;
+    for(uint32_t y = 0; y < DISPLAY_HEIGHT; y++)
+        if(memcmp(chip8->display[y], fork->display[y], sizeof(fork->display[y])) != 0 ||
+           memcmp(chip8->display2[y], fork->display2[y], sizeof(fork->display2[y])) != 0) chip8->dirty_rows |= 1ull << y;
+
+    memcpy(chip8->display, fork->display, sizeof(chip8->display));
+    memcpy(chip8->display2, fork->display2, sizeof(chip8->display2));
+    chip8->planes = fork->planes;
+    memcpy(chip8->stack, fork->stack, sizeof(chip8->stack));
+    memcpy(chip8->V, fork->V, sizeof(chip8->V));
+    memcpy(chip8->flags, fork->flags, sizeof(chip8->flags));
+    chip8->hires = fork->hires;
+    memcpy(chip8->keypads, fork->keypads, sizeof(chip8->keypads));
+    chip8->I = fork->I;
+    chip8->PC = fork->PC;
+    chip8->SP = fork->SP;
+    chip8->delay_timer = fork->delay_timer;
+    chip8->sound_timer = fork->sound_timer;
+    chip8->wait_key = fork->wait_key;
+    chip8->rng = fork->rng;
+    chip8->cycle_debt = fork->cycle_debt;
+    chip8->wait_vblank = fork->wait_vblank;
+    memcpy(chip8->audio_pattern, fork->audio_pattern, sizeof(chip8->audio_pattern));
+    chip8->pitch = fork->pitch;
+    chip8->pattern_loaded = fork->pattern_loaded;
+    chip8->state = fork->state;
+    chip8->fault = fork->fault;
+    chip8->idle_cycle = 0;
+}
+
+void fork_release(fork_pool_t * pool, fork_t * fork){
+    if(!fork) return;
+    release_pages(pool, fork->ram);
+    free_object(&pool->forks, fork);
+}
+
+void fork_detach(fork_pool_t * pool, chip8_t * chip8){
+    if(!chip8->ram_base) return;
+    release_pages(pool, chip8->ram_base);
+    chip8->ram_base = NULL;
+}
+
+void fork_pool_stats(const fork_pool_t * pool, uint32_t * forks, uint32_t * pages){
+    *forks = pool->forks.live;
+    *pages = pool->pages.live;
+}
@@ -0,0 +1,53 @@
+#ifndef CHIP8_FORK_H
+#define CHIP8_FORK_H
+
+// saved machines for branching search , e.g. clone a state , try each key
+// from it and restore it between the tries
+//
+// a fork holds the register file (V , I , PC , stack , timers , display ,
+// keys , random state ...) and a table of RAM_PAGES refcounted ram pages. pages are shared
+// copy on write : a machine remembers the pages of the fork it was last cloned
+// to or restored from (ram_base) and which pages it wrote since , so a clone
+// only copies the pages that changed and a restore only the pages that differ
+// from what the machine holds. a fork of a machine that never wrote ram shares
+// the whole page table and costs the register file.
+//
+// forks come from a pool of fixed size slabs , freed ones are reused. one pool
+// per thread , forks of one pool must not meet machines or forks of another
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "chip8_core.h"
+
+typedef struct fork fork_t;
+typedef struct fork_pool fork_pool_t;
+
+// empty pool , NULL when out of memory
+fork_pool_t * fork_pool_create(void);
+
+// frees every fork of the pool , machines using its pages must be detached first
+void fork_pool_destroy(fork_pool_t * pool);
+
+// state of the machine as a new fork , NULL when out of memory or when the
+// machine has the 64 KB xo-chip ram attached (only 4 KB machines fork). the
+// machine is then based on the fork's pages
+fork_t * fork_clone(fork_pool_t * pool, chip8_t * chip8);
+
+// put the machine back into the state of the fork , and base it on its pages.
+// attachments (decode cache , write hook , rom name) stay the machine's own ,
+// ram that changes is reported through ram_written
+void fork_restore(fork_pool_t * pool, chip8_t * chip8, fork_t * fork);
+
+// done with a fork , its pages go back to the pool once no machine or other
+// fork uses them
+void fork_release(fork_pool_t * pool, fork_t * fork);
+
+// the machine lets go of the pool's pages , before it's thrown away or used
+// with another pool
+void fork_detach(fork_pool_t * pool, chip8_t * chip8);
+
+// forks and ram pages alive in the pool
+void fork_pool_stats(const fork_pool_t * pool, uint32_t * forks, uint32_t * pages);
+
+#endif
@@ -0,0 +1,187 @@
+// fuzzing harness , a rom plus a key script in , a bounded run of the core out.
+// built for libFuzzer (make chip8-fuzz) or with its own main for AFL and for
+// replaying crashes (make chip8-fuzz-replay)
+//
+// an input is
+//   byte 0      bits 0-1 quirks (0 chip8 , 1 schip , 2 xochip , 3 chip8) ,
+//               bit 2 decodes every instruction instead of using the cache ,
+//               bit 3 runs on VIP timing (the cycle schedule , display wait)
+//   byte 1      k , key changes in the script
+//   3k bytes    frame , key mask low , key mask high , each holds from that
+//               frame on like a movie
+//   the rest    the rom at 0x200 , cut off at 4 KB
+//
+// every run starts from one pristine machine copied back with memcpy , only
+// the decoded instructions the last run could have made stale are dropped ,
+// so a run costs its instructions and not a reload. the machine's faults are
+// defined results , the harness only traps when it finds it in a state no
+// program should be able to reach
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8_core.h"
+#include "chip8_movie.h"
+
+#define FUZZ_FRAMES 60
+#define FUZZ_CLOCK 960 // instructions per second , 16 a frame
+#define MAX_ROM (sizeof(((chip8_t *) 0)->ram) - 0x200)
+
+typedef struct{
+    chip8_t pristine;  // font loaded , no rom , decode cache attached
+    chip8_t chip8;
+    decode_cache_t decode_cache;
+    uint32_t last_rom; // rom bytes the last run loaded
+} fuzz_t;
+
+static fuzz_t * fuzz_setup(void){
+    static fuzz_t fuzz;
+    static bool ready;
+    if(!ready){
+        static const uint8_t no_rom[1];
+        init_chip8_image(&fuzz.pristine, no_rom, 0, "fuzz");
+        attach_decode_cache(&fuzz.pristine, &fuzz.decode_cache);
+        ready = true;
+    }
+    return &fuzz;
+}
+
+// back to the pristine machine with the rom loaded. decoded instructions are
+// only stale where the last run wrote ram or the last rom was
+static void fuzz_reset(fuzz_t * fuzz, const uint8_t * rom, uint32_t size){
+    const uint32_t written = fuzz->chip8.written_pages;
+    memcpy(&fuzz->chip8, &fuzz->pristine, sizeof(fuzz->chip8));
+    memcpy(&fuzz->chip8.ram[0x200], rom, size);
+
+    for(uint32_t p = 0; p < RAM_PAGES; p++)
+        if((written >> p) & 1) invalidate_decode_cache(&fuzz->chip8, p * RAM_PAGE_SIZE, RAM_PAGE_SIZE);
+    invalidate_decode_cache(&fuzz->chip8, 0x200, size > fuzz->last_rom ? size : fuzz->last_rom);
+    fuzz->chip8.written_pages = 0;
+    fuzz->last_rom = size;
+}
+
+// what every program leaves true , whatever it does
+static void check_machine(const chip8_t * chip8){
+    if(chip8->SP > sizeof(chip8->stack) / sizeof(chip8->stack[0])) __builtin_trap();
+    if(chip8->wait_key != 0xFF && chip8->wait_key > 0xF) __builtin_trap();
+    if(chip8->fault && chip8->state != QUIT) __builtin_trap();
+    if(!chip8->rng) __builtin_trap();
+}
+
+static void fuzz_one(const uint8_t * data, size_t size){
+    if(size < 2) return;
+    fuzz_t * fuzz = fuzz_setup();
+
+    config_t config = {0};
+    init_config(&config);
+    config.inst_per_second = FUZZ_CLOCK;
+    config.current_extension = (data[0] & 3) == 3 ? CHIP8 : (extension_t) (data[0] & 3);
+    const bool cached = !(data[0] & 4);
+    if(data[0] & 8){
+        config.cycles_per_frame = VIP_CYCLES_PER_FRAME;
+        config.display_wait = true;
+    }
+
+    const uint8_t * script = data + 2;
+    uint32_t events = data[1];
+    if((size_t) events * 3 > size - 2) events = (size - 2) / 3;
+    const uint8_t * rom = script + events * 3;
+    size_t rom_size = data + size - rom;
+    if(rom_size > MAX_ROM) rom_size = MAX_ROM;
+
+    fuzz_reset(fuzz, rom, rom_size);
+    chip8_t * chip8 = &fuzz->chip8;
+    if(!cached) chip8->decode_cache = NULL;
+    const interpreter_t * interpreter = select_interpreter(config.current_extension);
+
+    uint32_t inst_acc = 0, next = 0;
+    for(uint32_t frame = 0; frame < FUZZ_FRAMES && chip8->state != QUIT; frame++){
+        for(; next < events && script[next * 3] <= frame; next++){
+            const uint16_t keys = script[next * 3 + 1] | script[next * 3 + 2] << 8;
+            for(uint8_t i = 0; i < 16; i++) chip8->keypads[i] = (keys >> i) & 1;
+        }
+        run_frame(interpreter, chip8, &config, &inst_acc);
+        update_timers(chip8);
+        check_machine(chip8);
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size){
+    fuzz_one(data, size);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+
+#include <unistd.h>
+
+static uint8_t input[2 + 255 * 3 + MAX_ROM];
+
+static size_t read_input(FILE * file){
+    return fread(input, 1, sizeof(input), file);
+}
+
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// each file (or stdin , the way AFL hands inputs over) runs once , with -n
+// every file runs N times and the runs per second are printed
+int main(int argc, char ** argv){
+    unsigned long repeats = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "n:")) != -1){
+        switch(opt){
+            case 'n': repeats = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "Usage %s [-n runs] [input ...] , stdin without inputs\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(optind >= argc){
+#ifdef __AFL_LOOP
+        // persistent mode , one process for many inputs
+        while(__AFL_LOOP(10000)){
+            const size_t size = read_input(stdin);
+            fuzz_one(input, size);
+        }
+#else
+        fuzz_one(input, read_input(stdin));
+#endif
+        return EXIT_SUCCESS;
+    }
+
+    for(int i = optind; i < argc; i++){
+        FILE * file = fopen(argv[i], "rb");
+        if(!file){
+            fprintf(stderr, "Could not open %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        const size_t size = read_input(file);
+        fclose(file);
+
+        const double start = now_seconds();
+        fuzz_one(input, size);
+        for(unsigned long r = 1; r < repeats; r++) fuzz_one(input, size);
+        const double seconds = now_seconds() - start;
+
+        const chip8_t * chip8 = &fuzz_setup()->chip8;
+        printf("%s : PC=%03X SP=%d fault %s", argv[i], chip8->PC, chip8->SP, fault_name(chip8->fault));
+        if(repeats) printf(" , %.0f runs/sec", seconds > 0 ? repeats / seconds : 0.0);
+        printf("\n");
+    }
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "chip8_input.h"
+
+#define QUEUE_SIZE 256       // key changes in flight , a power of two
+#define BUCKET_US 100        // latency histogram resolution
+#define BUCKETS 2000         // up to 200 ms , anything slower goes in the last one
+
+typedef struct{
+    uint64_t at;
+    uint8_t key;
+    bool down;
+} input_event_t;
+
+typedef struct{
+    uint32_t buckets[BUCKETS];
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+} latency_t;
+
+struct input{
+    uint64_t freq;
+    input_event_t events[QUEUE_SIZE];
+
+    // the queue , tail is only written by the producer and head by the
+    // consumer , each on its own cache line
+    _Alignas(64) atomic_uint tail;
+    _Alignas(64) atomic_uint head;
+
+    // emulation thread
+    _Alignas(64) uint64_t pressed[16]; // when each key went down
+    uint16_t unread;  // keys whose press no instruction has read yet
+    uint64_t shown;   // earliest press read and not in a frame yet , 0 = none
+    uint64_t presses;
+    uint64_t released_unread; // let go before the program looked
+    latency_t read;
+
+    // SDL thread
+    _Alignas(64) latency_t present;
+};
+
+input_t * input_create(uint64_t freq){
+    input_t * input = aligned_alloc(64, (sizeof(input_t) + 63) & ~(size_t) 63);
+    if(!input) return NULL;
+    *input = (input_t){ .freq = freq };
+    atomic_init(&input->tail, 0);
+    atomic_init(&input->head, 0);
+    return input;
+}
+
+void input_destroy(input_t * input){
+    free(input);
+}
+
+bool input_post(input_t * input, uint64_t at, uint8_t key, bool down){
+    const uint32_t tail = atomic_load_explicit(&input->tail, memory_order_relaxed);
+    if(tail - atomic_load_explicit(&input->head, memory_order_acquire) == QUEUE_SIZE) return false;
+
+    input->events[tail & (QUEUE_SIZE - 1)] = (input_event_t){ .at = at ? at : 1, .key = key & 0xF, .down = down };
+    atomic_store_explicit(&input->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+void input_deliver(input_t * input, uint64_t until, bool keypads[16]){
+    const uint32_t tail = atomic_load_explicit(&input->tail, memory_order_acquire);
+    uint32_t head = atomic_load_explicit(&input->head, memory_order_relaxed);
+    uint16_t downs = 0; // went down in this call
+
+    for(; head != tail; head++){
+        const input_event_t * event = &input->events[head & (QUEUE_SIZE - 1)];
+        const uint16_t bit = 1u << event->key;
+        if(event->at > until) break;
+        // a tap shorter than a slice still gets held for one
+        if(!event->down && (downs & bit)) break;
+
+        keypads[event->key] = event->down;
+        if(event->down){
+            downs |= bit;
+            if(!(input->unread & bit)){
+                input->pressed[event->key] = event->at;
+                input->unread |= bit;
+                input->presses++;
+            }
+        }
+        else if(input->unread & bit){
+            input->unread &= ~bit;
+            input->released_unread++;
+        }
+    }
+
+    atomic_store_explicit(&input->head, head, memory_order_release);
+}
+
+uint16_t input_unread(const input_t * input){
+    return input->unread;
+}
+
+static void add_latency(latency_t * latency, uint64_t ticks, uint64_t freq){
+    const uint64_t us = ticks / freq * 1000000 + ticks % freq * 1000000 / freq;
+    const uint64_t bucket = us / BUCKET_US;
+    latency->buckets[bucket < BUCKETS ? bucket : BUCKETS - 1]++;
+    latency->count++;
+    latency->total_us += us;
+    if(us > latency->max_us) latency->max_us = us;
+}
+
+void input_read(input_t * input, uint16_t read, uint64_t now){
+    uint16_t keys = read & input->unread;
+    input->unread &= ~keys;
+    for(; keys; keys &= keys - 1){
+        const uint64_t pressed = input->pressed[__builtin_ctz(keys)];
+        add_latency(&input->read, now > pressed ? now - pressed : 0, input->freq);
+        if(!input->shown || pressed < input->shown) input->shown = pressed;
+    }
+}
+
+uint64_t input_take_shown(input_t * input){
+    const uint64_t shown = input->shown;
+    input->shown = 0;
+    return shown;
+}
+
+void input_unshown(input_t * input, uint64_t pressed){
+    if(pressed && (!input->shown || pressed < input->shown)) input->shown = pressed;
+}
+
+void input_forget(input_t * input){
+    input->unread = 0;
+    input->shown = 0;
+}
+
+void input_presented(input_t * input, uint64_t pressed, uint64_t now){
+    if(pressed) add_latency(&input->present, now > pressed ? now - pressed : 0, input->freq);
+}
+
+// the upper edge of the bucket holding fraction of the samples (or the max
+// when that is lower) , in ms
+static double percentile(const latency_t * latency, double fraction){
+    const uint64_t rank = (uint64_t) (fraction * latency->count + 0.5);
+    uint64_t seen = 0, us = latency->max_us;
+    for(uint32_t b = 0; b < BUCKETS - 1; b++){
+        seen += latency->buckets[b];
+        if(seen >= rank && seen){
+            if((b + 1) * BUCKET_US < us) us = (b + 1) * BUCKET_US;
+            break;
+        }
+    }
+    return us / 1000.0;
+}
+
+static void report_latency(FILE * out, const char * name, const latency_t * latency){
+    if(!latency->count){
+        fprintf(out, "  %-20s no samples\n", name);
+        return;
+    }
+    fprintf(out, "  %-20s %6llu  mean %6.2f ms  median %6.1f ms  p95 %6.1f ms  p99 %6.1f ms  max %6.2f ms\n",
+            name, (unsigned long long) latency->count, (double) latency->total_us / latency->count / 1000.0,
+            percentile(latency, 0.5), percentile(latency, 0.95), percentile(latency, 0.99),
+            latency->max_us / 1000.0);
+}
+
+void input_report(const input_t * input, FILE * out){
+    fprintf(out, "input latency , %llu presses , %llu let go before the program read them\n",
+            (unsigned long long) input->presses, (unsigned long long) input->released_unread);
+    report_latency(out, "press to first read", &input->read);
+    report_latency(out, "press to present", &input->present);
+}
@@ -0,0 +1,55 @@
+#ifndef CHIP8_INPUT_H
+#define CHIP8_INPUT_H
+
+// keypad input for the front end , no SDL in here
+//
+// the SDL thread stamps every key change with the time it happened and queues
+// it , the emulation thread hands the changes to the machine between slices of
+// a frame once the emulated time has caught up with them. so a press reaches
+// the program within a slice of when it happened instead of at the next frame ,
+// and a burst of slices run to catch up still sees each change in the slice it
+// belongs to. lock free single producer , single consumer like the audio queue.
+//
+// each press is also timed , to the first instruction that read the key (see
+// keys_read in chip8_t) and to the first frame on screen after that. all times
+// are in ticks of one counter , freq a second
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct input input_t;
+
+// NULL when out of memory
+input_t * input_create(uint64_t freq);
+void input_destroy(input_t * input);
+
+// producer : key went down or up at time at. false when the queue is full
+bool input_post(input_t * input, uint64_t at, uint8_t key, bool down);
+
+// consumer : every change up to time until into keypads. a down starts
+// timing the press
+void input_deliver(input_t * input, uint64_t until, bool keypads[16]);
+
+// consumer : keys with a press waiting for its first read , bit per key
+uint16_t input_unread(const input_t * input);
+
+// consumer : the machine read the keys of read at time now , see keys_read
+void input_read(input_t * input, uint16_t read, uint64_t now);
+
+// consumer : the earliest press read since the last frame , for the frame
+// that is about to be handed over (0 = none) , and back when that frame was
+// replaced before it got on screen
+uint64_t input_take_shown(input_t * input);
+void input_unshown(input_t * input, uint64_t pressed);
+
+// consumer : presses so far aren't timed , while paused or rewinding
+void input_forget(input_t * input);
+
+// SDL thread : a frame stamped with pressed went on screen at now
+void input_presented(input_t * input, uint64_t pressed, uint64_t now);
+
+// once both threads are done , press counts and latency percentiles
+void input_report(const input_t * input, FILE * out);
+
+#endif
@@ -0,0 +1,574 @@
+// x86-64 basic block recompiler
+//
+// a block keeps the V registers it touches and I in host registers , PC is a
+// constant inside the block and only written back on exit. blocks are plain
+// functions : uint32_t block(chip8_t *) returning how many chip8
+// instructions they ran , with the chip8 pointer in rdi (System V)
+
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "chip8_jit.h"
+
+#define JIT_CODE_SIZE (4u << 20)   // 4MB of generated code before a flush
+#define JIT_DEFAULT_BLOCK 64
+#define JIT_MAX_INST_BYTES 48      // worst case native bytes per chip8 instruction
+#define JIT_BLOCK_OVERHEAD 256     // prologue , loads , stores , epilogue
+#define RAM_SIZE (sizeof(((chip8_t *)0)->ram))
+
+typedef uint32_t (*block_fn_t)(chip8_t * chip8);
+
+typedef enum {
+    BLOCK_NONE,      // not looked at yet
+    BLOCK_NATIVE,    // translated
+    BLOCK_INTERPRET, // first instruction can't be translated
+} block_kind_t;
+
+typedef enum {
+    ENDS_OTHER,
+    ENDS_CALL,   // 2NNN , faults with a full stack
+    ENDS_RETURN, // 00EE , faults with an empty one
+} block_end_t;
+
+typedef struct{
+    block_fn_t fn;
+    block_kind_t kind;
+    block_end_t ends;
+} block_t;
+
+struct jit{
+    uint8_t * code;
+    size_t code_used;
+    uint32_t max_block;
+    extension_t extension; // quirks the current blocks were built with
+    block_t blocks[RAM_SIZE];
+    bool translated[RAM_SIZE]; // ram bytes some block was built from
+};
+
+// host registers
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// rax , rcx , rdx are scratch (rdx ends up holding the new PC) , rdi is the machine
+static const uint8_t alloc_order[] = { RSI, R8, R9, R10, R11, RBX, RBP, R12, R13, R14, R15 };
+#define ALLOC_REGS (sizeof(alloc_order))
+
+static bool callee_saved(uint8_t reg){
+    return reg == RBX || reg == RBP || reg >= R12;
+}
+
+// 32 bit ALU opcodes (op r/m32 , r32) and the /digit for the 0x81 imm32 forms
+enum { OP_ADD = 0x01, OP_OR = 0x09, OP_AND = 0x21, OP_SUB = 0x29, OP_XOR = 0x31, OP_CMP = 0x39, OP_MOV = 0x89 };
+enum { IMM_ADD = 0, IMM_AND = 4, IMM_SUB = 5, IMM_XOR = 6, IMM_CMP = 7 };
+enum { SHIFT_SHL = 4, SHIFT_SHR = 5 };
+enum { CC_E = 0x4, CC_NE = 0x5 };
+
+typedef struct{
+    uint8_t * p;
+} emit_t;
+
+static void emit8(emit_t * e, uint8_t byte){ *e->p++ = byte; }
+
+static void emit16(emit_t * e, uint16_t word){
+    emit8(e, word & 0xFF);
+    emit8(e, word >> 8);
+}
+
+static void emit32(emit_t * e, uint32_t dword){
+    emit16(e, dword & 0xFFFF);
+    emit16(e, dword >> 16);
+}
+
+// REX prefix , only emitted when it carries something
+static void emit_rex(emit_t * e, bool w, uint8_t reg, uint8_t rm){
+    const uint8_t rex = 0x40 | (w << 3) | (((reg >> 3) & 1) << 2) | ((rm >> 3) & 1);
+    if(rex != 0x40) emit8(e, rex);
+}
+
+static void emit_modrm_rr(emit_t * e, uint8_t reg, uint8_t rm){
+    emit8(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op dst32 , src32
+static void emit_alu_rr(emit_t * e, uint8_t op, uint8_t dst, uint8_t src){
+    emit_rex(e, false, src, dst);
+    emit8(e, op);
+    emit_modrm_rr(e, src, dst);
+}
+
+// op dst32 , imm32
+static void emit_alu_ri(emit_t * e, uint8_t digit, uint8_t dst, uint32_t imm){
+    emit_rex(e, false, 0, dst);
+    emit8(e, 0x81);
+    emit_modrm_rr(e, digit, dst);
+    emit32(e, imm);
+}
+
+static void emit_mov_ri(emit_t * e, uint8_t dst, uint32_t imm){
+    emit_rex(e, false, 0, dst);
+    emit8(e, 0xB8 + (dst & 7));
+    emit32(e, imm);
+}
+
+static void emit_shift_ri(emit_t * e, uint8_t digit, uint8_t dst, uint8_t count){
+    emit_rex(e, false, 0, dst);
+    emit8(e, 0xC1);
+    emit_modrm_rr(e, digit, dst);
+    emit8(e, count);
+}
+
+// cmovcc dst32 , src32
+static void emit_cmov(emit_t * e, uint8_t cc, uint8_t dst, uint8_t src){
+    emit_rex(e, false, dst, src);
+    emit8(e, 0x0F);
+    emit8(e, 0x40 | cc);
+    emit_modrm_rr(e, dst, src);
+}
+
+// movzx dst32 , byte/word [rdi + disp32]
+static void emit_load_zx(emit_t * e, bool word, uint8_t dst, uint32_t disp){
+    emit_rex(e, false, dst, RDI);
+    emit8(e, 0x0F);
+    emit8(e, word ? 0xB7 : 0xB6);
+    emit8(e, 0x80 | ((dst & 7) << 3) | RDI);
+    emit32(e, disp);
+}
+
+// mov [rdi + disp32] , al
+static void emit_store_al(emit_t * e, uint32_t disp){
+    emit8(e, 0x88);
+    emit8(e, 0x80 | (RAX << 3) | RDI);
+    emit32(e, disp);
+}
+
+// mov [rdi + disp32] , ax / dx
+static void emit_store16(emit_t * e, uint8_t src, uint32_t disp){
+    emit8(e, 0x66);
+    emit8(e, 0x89);
+    emit8(e, 0x80 | (src << 3) | RDI);
+    emit32(e, disp);
+}
+
+static void emit_push(emit_t * e, uint8_t reg){
+    if(reg >= R8) emit8(e, 0x41);
+    emit8(e, 0x50 + (reg & 7));
+}
+
+static void emit_pop(emit_t * e, uint8_t reg){
+    if(reg >= R8) emit8(e, 0x41);
+    emit8(e, 0x58 + (reg & 7));
+}
+
+typedef enum {
+    T_NO,     // leave to the interpreter
+    T_SIMPLE, // straight line
+    T_END,    // ends the block (jump , call , return , skip)
+} translate_t;
+
+// what an instruction needs : V registers read or written and I
+typedef struct{
+    translate_t kind;
+    uint16_t v_used;
+    uint16_t v_written;
+    bool i_used;
+    bool i_written;
+} usage_t;
+
+#define VBIT(x) ((uint16_t) (1u << (x)))
+
+static usage_t classify(const instruction_t * inst){
+    usage_t u = { .kind = T_NO };
+    const uint16_t vx = VBIT(inst->X), vy = VBIT(inst->Y), vf = VBIT(0xF);
+
+    switch(inst->opcode >> 12){
+        case 0x0:
+            if(inst->opcode == 0x00EE) u.kind = T_END;
+            break;
+        case 0x1:
+        case 0x2:
+            u.kind = T_END;
+            break;
+        case 0x3:
+        case 0x4:
+            u = (usage_t){ .kind = T_END, .v_used = vx };
+            break;
+        case 0x5:
+            if(inst->N == 0) u = (usage_t){ .kind = T_END, .v_used = vx | vy };
+            break;
+        case 0x9:
+            u = (usage_t){ .kind = T_END, .v_used = vx | vy };
+            break;
+        case 0x6:
+        case 0x7:
+            u = (usage_t){ .kind = T_SIMPLE, .v_used = vx, .v_written = vx };
+            break;
+        case 0x8:
+            switch(inst->N){
+                case 0x0:
+                    u = (usage_t){ .kind = T_SIMPLE, .v_used = vx | vy, .v_written = vx };
+                    break;
+                case 0x1: case 0x2: case 0x3: case 0x4: case 0x5:
+                case 0x6: case 0x7: case 0xE:
+                    u = (usage_t){ .kind = T_SIMPLE, .v_used = vx | vy | vf, .v_written = vx | vf };
+                    break;
+            }
+            break;
+        case 0xA:
+            u = (usage_t){ .kind = T_SIMPLE, .i_used = true, .i_written = true };
+            break;
+        case 0xB:
+            u = (usage_t){ .kind = T_END, .v_used = VBIT(0) };
+            break;
+        case 0xF:
+            switch(inst->NN){
+                case 0x07:
+                    u = (usage_t){ .kind = T_SIMPLE, .v_used = vx, .v_written = vx };
+                    break;
+                case 0x15:
+                case 0x18:
+                    u = (usage_t){ .kind = T_SIMPLE, .v_used = vx };
+                    break;
+                case 0x1E:
+                case 0x29:
+                    u = (usage_t){ .kind = T_SIMPLE, .v_used = vx, .i_used = true, .i_written = true };
+                    break;
+            }
+            break;
+    }
+    return u;
+}
+
+static instruction_t fetch(const chip8_t * chip8, uint16_t pc){
+    const uint16_t opcode = (chip8->ram[pc] << 8) | chip8->ram[pc + 1];
+    return (instruction_t){
+        .opcode = opcode,
+        .NNN = opcode & 0x0FFF,
+        .NN = opcode & 0x0FF,
+        .N = opcode & 0x0F,
+        .X = (opcode >> 8) & 0x0F,
+        .Y = (opcode >> 4) & 0x0F,
+    };
+}
+
+// one chip8 instruction , v[] maps chip8 registers to host registers
+static void emit_instruction(emit_t * e, const instruction_t * inst, const uint8_t v[16],
+                             uint8_t ireg, uint16_t next_pc, bool chip8_quirks){
+    const uint8_t vx = v[inst->X], vy = v[inst->Y], vf = v[0xF];
+
+    switch(inst->opcode >> 12){
+        case 0x0: // 00EE : PC = stack[--SP]
+            emit_load_zx(e, false, RAX, offsetof(chip8_t, SP));
+            emit_alu_ri(e, IMM_SUB, RAX, 1);
+            emit_store_al(e, offsetof(chip8_t, SP));
+            emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC0);                 // movzx eax , al
+            emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0x94); emit8(e, 0x47); // movzx edx , word [rdi + rax*2 + stack]
+            emit32(e, offsetof(chip8_t, stack));
+            break;
+
+        case 0x1:
+            emit_mov_ri(e, RDX, inst->NNN);
+            break;
+
+        case 0x2: // stack[SP++] = PC
+            emit_load_zx(e, false, RAX, offsetof(chip8_t, SP));
+            emit8(e, 0x66); emit8(e, 0xC7); emit8(e, 0x84); emit8(e, 0x47);     // mov word [rdi + rax*2 + stack] , next_pc
+            emit32(e, offsetof(chip8_t, stack)); emit16(e, next_pc);
+            emit_alu_ri(e, IMM_ADD, RAX, 1);
+            emit_store_al(e, offsetof(chip8_t, SP));
+            emit_mov_ri(e, RDX, inst->NNN);
+            break;
+
+        case 0x3:
+        case 0x4:
+        case 0x5:
+        case 0x9:
+            // PC = condition ? next_pc + 2 : next_pc
+            emit_mov_ri(e, RDX, next_pc);
+            emit_mov_ri(e, RCX, next_pc + 2);
+            if(inst->opcode >> 12 == 0x3 || inst->opcode >> 12 == 0x4) emit_alu_ri(e, IMM_CMP, vx, inst->NN);
+            else emit_alu_rr(e, OP_CMP, vx, vy);
+            emit_cmov(e, (inst->opcode >> 12 == 0x3 || inst->opcode >> 12 == 0x5) ? CC_E : CC_NE, RDX, RCX);
+            break;
+
+        case 0x6:
+            emit_mov_ri(e, vx, inst->NN);
+            break;
+
+        case 0x7:
+            emit_alu_ri(e, IMM_ADD, vx, inst->NN);
+            emit_alu_ri(e, IMM_AND, vx, 0xFF);
+            break;
+
+        case 0x8:
+            switch(inst->N){
+                case 0x0:
+                    emit_alu_rr(e, OP_MOV, vx, vy);
+                    break;
+
+                case 0x1:
+                case 0x2:
+                case 0x3:
+                    emit_alu_rr(e, inst->N == 1 ? OP_OR : inst->N == 2 ? OP_AND : OP_XOR, vx, vy);
+                    if(chip8_quirks) emit_mov_ri(e, vf, 0);
+                    break;
+
+                case 0x4: // ecx = sum >> 8 is the carry
+                    emit_alu_rr(e, OP_MOV, RAX, vx);
+                    emit_alu_rr(e, OP_ADD, RAX, vy);
+                    emit_alu_rr(e, OP_MOV, RCX, RAX);
+                    emit_shift_ri(e, SHIFT_SHR, RCX, 8);
+                    emit_alu_ri(e, IMM_AND, RAX, 0xFF);
+                    emit_alu_rr(e, OP_MOV, vx, RAX);
+                    emit_alu_rr(e, OP_MOV, vf, RCX);
+                    break;
+
+                case 0x5:
+                case 0x7: // no borrow when the 32 bit difference stays positive
+                    emit_alu_rr(e, OP_MOV, RAX, inst->N == 5 ? vx : vy);
+                    emit_alu_rr(e, OP_SUB, RAX, inst->N == 5 ? vy : vx);
+                    emit_alu_rr(e, OP_MOV, RCX, RAX);
+                    emit_shift_ri(e, SHIFT_SHR, RCX, 31);
+                    emit_alu_ri(e, IMM_XOR, RCX, 1);
+                    emit_alu_ri(e, IMM_AND, RAX, 0xFF);
+                    emit_alu_rr(e, OP_MOV, vx, RAX);
+                    emit_alu_rr(e, OP_MOV, vf, RCX);
+                    break;
+
+                case 0x6:
+                    emit_alu_rr(e, OP_MOV, RAX, chip8_quirks ? vy : vx);
+                    emit_alu_rr(e, OP_MOV, RCX, RAX);
+                    emit_alu_ri(e, IMM_AND, RCX, 1);
+                    emit_shift_ri(e, SHIFT_SHR, RAX, 1);
+                    emit_alu_rr(e, OP_MOV, vx, RAX);
+                    emit_alu_rr(e, OP_MOV, vf, RCX);
+                    break;
+
+                case 0xE: // carry comes from VY in both modes , like op_8XYE
+                    emit_alu_rr(e, OP_MOV, RCX, vy);
+                    emit_shift_ri(e, SHIFT_SHR, RCX, 7);
+                    emit_alu_rr(e, OP_MOV, RAX, chip8_quirks ? vy : vx);
+                    emit_shift_ri(e, SHIFT_SHL, RAX, 1);
+                    emit_alu_ri(e, IMM_AND, RAX, 0xFF);
+                    emit_alu_rr(e, OP_MOV, vx, RAX);
+                    emit_alu_rr(e, OP_MOV, vf, RCX);
+                    break;
+            }
+            break;
+
+        case 0xA:
+            emit_mov_ri(e, ireg, inst->NNN);
+            break;
+
+        case 0xB:
+            emit_alu_rr(e, OP_MOV, RDX, v[0]);
+            emit_alu_ri(e, IMM_ADD, RDX, inst->NNN);
+            break;
+
+        case 0xF:
+            switch(inst->NN){
+                case 0x07:
+                    emit_load_zx(e, false, vx, offsetof(chip8_t, delay_timer));
+                    break;
+                case 0x15:
+                    emit_alu_rr(e, OP_MOV, RAX, vx);
+                    emit_store_al(e, offsetof(chip8_t, delay_timer));
+                    break;
+                case 0x18:
+                    emit_alu_rr(e, OP_MOV, RAX, vx);
+                    emit_store_al(e, offsetof(chip8_t, sound_timer));
+                    break;
+                case 0x1E:
+                    emit_alu_rr(e, OP_ADD, ireg, vx);
+                    emit_alu_ri(e, IMM_AND, ireg, 0xFFFF);
+                    break;
+                case 0x29:
+                    emit_alu_rr(e, OP_MOV, RAX, vx);
+                    emit8(e, 0x8D); emit8(e, 0x04); emit8(e, 0x80); // lea eax , [rax + rax*4]
+                    emit_alu_rr(e, OP_MOV, ireg, RAX);
+                    break;
+            }
+            break;
+    }
+}
+
+static uint32_t popcount16(uint16_t bits){
+    uint32_t count = 0;
+    for(; bits; bits &= bits - 1) count++;
+    return count;
+}
+
+// translate the block starting at pc , leaves blocks[pc] NATIVE or INTERPRET
+static void compile_block(jit_t * jit, const chip8_t * chip8, const config_t * config, uint16_t pc){
+    block_t * block = &jit->blocks[pc];
+
+    // scan : how far can the block go before it runs out of registers
+    usage_t total = {0};
+    uint32_t count = 0;
+    bool ended = false;
+    uint16_t end_pc = pc;
+
+    while(count < jit->max_block && end_pc + 1u < RAM_SIZE){
+        const instruction_t inst = fetch(chip8, end_pc);
+        const usage_t u = classify(&inst);
+        if(u.kind == T_NO) break;
+
+        const uint16_t v_used = total.v_used | u.v_used;
+        const bool i_used = total.i_used || u.i_used;
+        if(popcount16(v_used) + i_used > ALLOC_REGS) break;
+
+        total.v_used = v_used;
+        total.v_written |= u.v_written;
+        total.i_used = i_used;
+        total.i_written = total.i_written || u.i_written;
+        count++;
+        end_pc += 2;
+
+        if(u.kind == T_END){
+            ended = true;
+            break;
+        }
+    }
+
+    if(count == 0){
+        block->kind = BLOCK_INTERPRET;
+        return;
+    }
+
+    if(jit->code_used + JIT_BLOCK_OVERHEAD + count * JIT_MAX_INST_BYTES > JIT_CODE_SIZE){
+        jit_flush(jit);
+    }
+
+    // hand out host registers
+    uint8_t v[16] = {0};
+    uint8_t ireg = RAX;
+    uint32_t next_reg = 0;
+    for(uint8_t x = 0; x < 16; x++)
+        if(total.v_used & VBIT(x)) v[x] = alloc_order[next_reg++];
+    if(total.i_used) ireg = alloc_order[next_reg++];
+
+    uint8_t saved[ALLOC_REGS];
+    uint32_t saved_count = 0;
+    for(uint32_t i = 0; i < next_reg; i++)
+        if(callee_saved(alloc_order[i])) saved[saved_count++] = alloc_order[i];
+
+    uint8_t * const start = jit->code + jit->code_used;
+    emit_t e = { .p = start };
+
+    for(uint32_t i = 0; i < saved_count; i++) emit_push(&e, saved[i]);
+    for(uint8_t x = 0; x < 16; x++)
+        if(total.v_used & VBIT(x)) emit_load_zx(&e, false, v[x], offsetof(chip8_t, V) + x);
+    if(total.i_used) emit_load_zx(&e, true, ireg, offsetof(chip8_t, I));
+
+    const bool chip8_quirks = config->current_extension == CHIP8;
+    for(uint16_t at = pc; at < end_pc; at += 2){
+        const instruction_t inst = fetch(chip8, at);
+        emit_instruction(&e, &inst, v, ireg, at + 2, chip8_quirks);
+    }
+    if(!ended) emit_mov_ri(&e, RDX, end_pc); // fell into something untranslatable
+
+    for(uint8_t x = 0; x < 16; x++)
+        if(total.v_written & VBIT(x)){
+            emit_alu_rr(&e, OP_MOV, RAX, v[x]);
+            emit_store_al(&e, offsetof(chip8_t, V) + x);
+        }
+    if(total.i_written){
+        emit_alu_rr(&e, OP_MOV, RAX, ireg);
+        emit_store16(&e, RAX, offsetof(chip8_t, I));
+    }
+    emit_store16(&e, RDX, offsetof(chip8_t, PC));
+    emit_mov_ri(&e, RAX, count);
+    for(uint32_t i = saved_count; i-- > 0;) emit_pop(&e, saved[i]);
+    emit8(&e, 0xC3); // ret
+
+    jit->code_used += e.p - start;
+    memset(&jit->translated[pc], true, end_pc - pc);
+
+    block->fn = (block_fn_t) (void *) start;
+    block->kind = BLOCK_NATIVE;
+    const uint16_t last = fetch(chip8, end_pc - 2).opcode;
+    block->ends = !ended ? ENDS_OTHER : last >> 12 == 0x2 ? ENDS_CALL : last == 0x00EE ? ENDS_RETURN : ENDS_OTHER;
+}
+
+static void jit_ram_written(void * userdata, uint16_t addr, uint32_t len){
+    jit_t * jit = userdata;
+    const uint32_t end = (uint32_t) addr + len < RAM_SIZE ? (uint32_t) addr + len : RAM_SIZE;
+
+    for(uint32_t i = addr; i < end; i++)
+        if(jit->translated[i]){
+            // self modifying code is rare , just start over
+            jit_flush(jit);
+            return;
+        }
+}
+
+jit_t * jit_create(uint32_t max_block){
+#if defined(__x86_64__)
+    jit_t * jit = calloc(1, sizeof(*jit));
+    if(!jit) return NULL;
+
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(jit->code == MAP_FAILED){
+        free(jit);
+        return NULL;
+    }
+
+    jit->max_block = max_block ? max_block : JIT_DEFAULT_BLOCK;
+    return jit;
+#else
+    (void)max_block;
+    return NULL;
+#endif
+}
+
+void jit_destroy(jit_t * jit){
+    if(!jit) return;
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit);
+}
+
+void jit_flush(jit_t * jit){
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->translated, 0, sizeof(jit->translated));
+    jit->code_used = 0;
+}
+
+void jit_attach(jit_t * jit, chip8_t * chip8){
+    jit_flush(jit);
+    set_ram_write_hook(chip8, jit_ram_written, jit);
+}
+
+uint32_t jit_step(jit_t * jit, chip8_t * chip8, const config_t * config){
+    if(config->current_extension != jit->extension){
+        jit_flush(jit);
+        jit->extension = config->current_extension;
+    }
+
+    // xo-chip skips step over F000's second word and memory may be 64 KB ,
+    // blocks don't know either
+    if(jit->extension == XOCHIP){
+        emulate_instruction(chip8, config);
+        return 1;
+    }
+
+    const uint16_t pc = chip8->PC & (RAM_SIZE - 1);
+    block_t * block = &jit->blocks[pc];
+
+    if(block->kind == BLOCK_NONE) compile_block(jit, chip8, config, pc);
+    // a block that would fault is interpreted instead , up to the fault
+    const bool faults = (block->ends == ENDS_CALL && chip8->SP == sizeof(chip8->stack) / sizeof(chip8->stack[0])) ||
+                        (block->ends == ENDS_RETURN && chip8->SP == 0);
+    if(block->kind == BLOCK_NATIVE && chip8->PC == pc && !faults) return block->fn(chip8);
+
+    emulate_instruction(chip8, config);
+    return 1;
+}
+
+uint32_t jit_run(jit_t * jit, chip8_t * chip8, const config_t * config, uint32_t budget){
+    uint32_t executed = 0;
+    while(executed < budget && chip8->state != QUIT) executed += jit_step(jit, chip8, config);
+    return executed;
+}
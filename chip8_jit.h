@@ -0,0 +1,36 @@
+#ifndef CHIP8_JIT_H
+#define CHIP8_JIT_H
+
+// x86-64 basic block recompiler for the chip8 core
+//
+// straight line runs of ALU / load / timer opcodes are translated to native
+// code and end at 1NNN , 2NNN , 00EE , BNNN or a skip. anything else (DXYN ,
+// FX0A , FX33 , FX55 , ...) goes through emulate_instruction , and so does
+// every xo-chip instruction
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "chip8_core.h"
+
+typedef struct jit jit_t;
+
+// NULL when the host isn't x86-64 or executable memory can't be mapped.
+// max_block caps how many chip8 instructions go in one block (0 = default)
+jit_t * jit_create(uint32_t max_block);
+void jit_destroy(jit_t * jit);
+
+// hook the jit up to a machine , takes over its ram write hook so blocks
+// covering written memory get dropped
+void jit_attach(jit_t * jit, chip8_t * chip8);
+
+// run one block (or one interpreted instruction) , returns instructions executed
+uint32_t jit_step(jit_t * jit, chip8_t * chip8, const config_t * config);
+
+// run blocks until at least budget instructions went by , returns the real count
+uint32_t jit_run(jit_t * jit, chip8_t * chip8, const config_t * config, uint32_t budget);
+
+// throw away every translated block
+void jit_flush(jit_t * jit);
+
+#endif
@@ -0,0 +1,453 @@
+// lockstep stepping of many machines over one rom , see chip8_lanes.h
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_lanes.h"
+
+// load8 / load16 return vectors wider than the baseline abi , they're always
+// inlined so that doesn't matter
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+_Static_assert(LANE_WIDTH == 32, "lane sets are uint32_t bitmasks");
+
+typedef uint8_t u8v __attribute__((vector_size(LANE_WIDTH)));
+typedef int8_t s8v __attribute__((vector_size(LANE_WIDTH)));
+typedef uint16_t u16v __attribute__((vector_size(LANE_WIDTH * 2)));
+typedef int16_t s16v __attribute__((vector_size(LANE_WIDTH * 2)));
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+// on x86-64 gcc builds an avx2 copy of the block loop next to the baseline
+// (sse2) one and picks at load time
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define VECTOR_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define VECTOR_CLONES
+#endif
+
+#define LANE_PAGE_SHIFT 6 // 64 byte pages , 64 of them , one uint64_t per lane
+
+typedef struct{
+    _Alignas(64) uint8_t V[16][LANE_WIDTH]; // [register][lane]
+    _Alignas(64) uint16_t I[LANE_WIDTH];
+    _Alignas(64) uint16_t PC[LANE_WIDTH];
+    _Alignas(64) uint8_t delay_timer[LANE_WIDTH];
+    _Alignas(64) uint8_t sound_timer[LANE_WIDTH];
+    uint64_t written[LANE_WIDTH]; // ram pages the lane wrote , code there may not match the image
+    uint64_t ran[LANE_WIDTH]; // instructions of a lane that halted , up to the halting one
+    uint64_t steps;  // instructions each active lane has run since the load
+    uint32_t active; // bit per lane still running , a halted lane drops out
+    chip8_t machines[LANE_WIDTH]; // everything else , and the scalar fallback
+} block_t;
+
+struct lanes{
+    uint32_t capacity;
+    uint32_t block_count;
+    block_t * blocks;
+    decode_cache_t * decode_caches; // one per lane , for the scalar fallback
+    uint8_t image[sizeof(((chip8_t *) 0)->ram)]; // ram every lane started from
+    uint64_t vector_steps;
+    uint64_t scalar_steps;
+};
+
+lanes_t * lanes_create(uint32_t capacity){
+    lanes_t * lanes = calloc(1, sizeof(*lanes));
+    if(!lanes) return NULL;
+
+    lanes->capacity = capacity;
+    lanes->block_count = (capacity + LANE_WIDTH - 1) / LANE_WIDTH;
+    lanes->blocks = aligned_alloc(_Alignof(block_t), lanes->block_count * sizeof(block_t));
+    lanes->decode_caches = malloc(capacity * sizeof(decode_cache_t));
+    if(!lanes->blocks || !lanes->decode_caches){
+        lanes_destroy(lanes);
+        return NULL;
+    }
+    return lanes;
+}
+
+void lanes_destroy(lanes_t * lanes){
+    if(!lanes) return;
+    free(lanes->decode_caches);
+    free(lanes->blocks);
+    free(lanes);
+}
+
+static void mark_pages(uint64_t * written, uint32_t first, uint32_t last){
+    for(uint32_t page = first >> LANE_PAGE_SHIFT; page <= last >> LANE_PAGE_SHIFT; page++)
+        *written |= 1ull << page;
+}
+
+// write hook of every lane's machine , userdata is its written page mask. a
+// range past the end of ram goes on at 0 , like the handlers' addresses
+static void lane_ram_written(void * data, uint16_t addr, uint32_t len){
+    uint64_t * written = data;
+    const uint32_t size = sizeof(((chip8_t *) 0)->ram);
+    if(!len) return;
+    if(len > size) len = size;
+    addr &= size - 1;
+
+    const uint32_t end = (uint32_t) addr + len;
+    if(end > size){
+        mark_pages(written, addr, size - 1);
+        mark_pages(written, 0, end - size - 1);
+    }
+    else mark_pages(written, addr, end - 1);
+}
+
+bool lanes_load(lanes_t * lanes, uint32_t count, const uint8_t * image, size_t size, const char rom_name []){
+    if(count > lanes->capacity) return false;
+
+    memset(lanes->blocks, 0, lanes->block_count * sizeof(block_t));
+    lanes->vector_steps = lanes->scalar_steps = 0;
+
+    // the first lane is loaded for real and the rest are copies of it
+    chip8_t * first = &lanes->blocks[0].machines[0];
+    if(!init_chip8_image(first, image, size, rom_name)) return false;
+    memcpy(lanes->image, first->ram, sizeof(lanes->image));
+
+    for(uint32_t lane = 0; lane < count; lane++){
+        block_t * block = &lanes->blocks[lane / LANE_WIDTH];
+        const uint32_t l = lane % LANE_WIDTH;
+        chip8_t * machine = &block->machines[l];
+
+        if(lane) *machine = *first;
+        attach_decode_cache(machine, &lanes->decode_caches[lane]);
+        set_ram_write_hook(machine, lane_ram_written, &block->written[l]);
+
+        block->PC[l] = first->PC;
+        block->active |= 1u << l;
+    }
+    return true;
+}
+
+void lanes_seed(lanes_t * lanes, uint32_t lane, uint32_t seed){
+    seed_chip8(&lanes->blocks[lane / LANE_WIDTH].machines[lane % LANE_WIDTH], seed);
+}
+
+void lanes_set_keys(lanes_t * lanes, uint32_t lane, uint16_t keys){
+    chip8_t * machine = &lanes->blocks[lane / LANE_WIDTH].machines[lane % LANE_WIDTH];
+    for(uint8_t i = 0; i < 16; i++) machine->keypads[i] = (keys >> i) & 1;
+}
+
+// registers between the lanes and a lane's own machine
+static void to_machine(block_t * block, uint32_t l){
+    chip8_t * machine = &block->machines[l];
+    for(uint8_t r = 0; r < 16; r++) machine->V[r] = block->V[r][l];
+    machine->I = block->I[l];
+    machine->PC = block->PC[l];
+    machine->delay_timer = block->delay_timer[l];
+    machine->sound_timer = block->sound_timer[l];
+}
+
+static void from_machine(block_t * block, uint32_t l){
+    const chip8_t * machine = &block->machines[l];
+    for(uint8_t r = 0; r < 16; r++) block->V[r][l] = machine->V[r];
+    block->I[l] = machine->I;
+    block->PC[l] = machine->PC;
+    block->delay_timer[l] = machine->delay_timer;
+    block->sound_timer[l] = machine->sound_timer;
+}
+
+// whole lane rows in and out of the block. the helpers taking vectors are
+// macros , gcc notes an abi change for every 32 byte vector parameter
+ALWAYS_INLINE u8v load8(const uint8_t * p){ u8v v; memcpy(&v, p, sizeof(v)); return v; }
+ALWAYS_INLINE u16v load16(const uint16_t * p){ u16v v; memcpy(&v, p, sizeof(v)); return v; }
+#define store8(p, v) memcpy((p), (u8v [1]) { (v) }, sizeof(u8v))
+#define store16(p, v) memcpy((p), (u16v [1]) { (v) }, sizeof(u16v))
+
+// value in the masked lanes , old elsewhere
+#define blend(mask, value, old) (((value) & (mask)) | ((old) & ~(mask)))
+
+// 0xFF / 0x00 lane mask to 0xFFFF / 0x0000
+#define widen_mask(mask) ((u16v) __builtin_convertvector((s8v) (mask), s16v))
+
+// V[X] = value in the masked lanes only
+#define set_v(block, X, mask, value) store8((block)->V[X], blend(mask, value, load8((block)->V[X])))
+
+// one opcode across the lanes in group , false (and nothing touched) when it
+// has no vector form. same results as the handlers in chip8_core.c. calls and
+// returns only touch each lane's stack , not its other registers , so they
+// stay out of the interpreter too
+ALWAYS_INLINE bool vector_op(block_t * block, uint16_t opcode, uint32_t group, bool chip8_quirks, bool xo_skips){
+    uint8_t bytes[LANE_WIDTH];
+    for(uint32_t l = 0; l < LANE_WIDTH; l++) bytes[l] = -(uint8_t) ((group >> l) & 1);
+    const u8v m8 = load8(bytes);
+    const u16v m16 = widen_mask(m8);
+
+    const uint8_t X = (opcode >> 8) & 0x0F;
+    const uint8_t Y = (opcode >> 4) & 0x0F;
+    const uint8_t NN = opcode & 0xFF;
+    const uint16_t NNN = opcode & 0x0FFF;
+    const u8v vx = load8(block->V[X]);
+    const u8v vy = load8(block->V[Y]);
+    const u16v pc = load16(block->PC);
+    u16v next = pc + (m16 & 2);
+    u8v carry;
+
+    // an xo-chip skip over F000 NNNN is 4 bytes , that depends on the next
+    // opcode of each lane , leave them to the interpreter
+    if(xo_skips && (opcode >> 12 == 0x3 || opcode >> 12 == 0x4 || opcode >> 12 == 0x5 || opcode >> 12 == 0x9))
+        return false;
+
+    const uint32_t stack_size = sizeof(block->machines[0].stack) / sizeof(block->machines[0].stack[0]);
+    switch(opcode >> 12){
+        case 0x0:
+            if(NN != 0xEE) return false;
+            // an underflow halts , the interpreter does that
+            for(uint32_t g = group; g; g &= g - 1)
+                if(!block->machines[__builtin_ctz(g)].SP) return false;
+            for(uint32_t g = group; g; g &= g - 1){
+                chip8_t * machine = &block->machines[__builtin_ctz(g)];
+                block->PC[__builtin_ctz(g)] = machine->stack[--machine->SP];
+            }
+            return true;
+        case 0x1:
+            store16(block->PC, blend(m16, (u16v) {0} + NNN, pc));
+            return true;
+        case 0x2:
+            for(uint32_t g = group; g; g &= g - 1)
+                if(block->machines[__builtin_ctz(g)].SP == stack_size) return false;
+            for(uint32_t g = group; g; g &= g - 1){
+                chip8_t * machine = &block->machines[__builtin_ctz(g)];
+                machine->stack[machine->SP++] = block->PC[__builtin_ctz(g)] + 2;
+            }
+            store16(block->PC, blend(m16, (u16v) {0} + NNN, pc));
+            return true;
+        case 0x3: next += widen_mask((u8v) (vx == NN)) & m16 & 2; break;
+        case 0x4: next += widen_mask((u8v) (vx != NN)) & m16 & 2; break;
+        case 0x5:
+            if(opcode & 0x0F) return false;
+            next += widen_mask((u8v) (vx == vy)) & m16 & 2;
+            break;
+        case 0x6: set_v(block, X, m8, (u8v) {0} + NN); break;
+        case 0x7: set_v(block, X, m8, vx + NN); break;
+        case 0x8:
+            switch(opcode & 0x0F){
+                case 0x0: set_v(block, X, m8, vy); break;
+                case 0x1:
+                    set_v(block, X, m8, vx | vy);
+                    if(chip8_quirks) set_v(block, 0xF, m8, (u8v) {0});
+                    break;
+                case 0x2:
+                    set_v(block, X, m8, vx & vy);
+                    if(chip8_quirks) set_v(block, 0xF, m8, (u8v) {0});
+                    break;
+                case 0x3:
+                    set_v(block, X, m8, vx ^ vy);
+                    if(chip8_quirks) set_v(block, 0xF, m8, (u8v) {0});
+                    break;
+                case 0x4:
+                    carry = (u8v) (vx + vy < vx) & 1;
+                    set_v(block, X, m8, vx + vy);
+                    set_v(block, 0xF, m8, carry);
+                    break;
+                case 0x5:
+                    carry = (u8v) (vy <= vx) & 1;
+                    set_v(block, X, m8, vx - vy);
+                    set_v(block, 0xF, m8, carry);
+                    break;
+                case 0x6:
+                    carry = (chip8_quirks ? vy : vx) & 1;
+                    set_v(block, X, m8, (chip8_quirks ? vy : vx) >> 1);
+                    set_v(block, 0xF, m8, carry);
+                    break;
+                case 0x7:
+                    carry = (u8v) (vx <= vy) & 1;
+                    set_v(block, X, m8, vy - vx);
+                    set_v(block, 0xF, m8, carry);
+                    break;
+                case 0xE:
+                    carry = vy >> 7;
+                    set_v(block, X, m8, (chip8_quirks ? vy : vx) << 1);
+                    set_v(block, 0xF, m8, carry);
+                    break;
+                default:
+                    return false;
+            }
+            break;
+        case 0x9: next += widen_mask((u8v) (vx != vy)) & m16 & 2; break;
+        case 0xA: store16(block->I, blend(m16, (u16v) {0} + NNN, load16(block->I))); break;
+        case 0xF:
+            switch(NN){
+                case 0x07: set_v(block, X, m8, load8(block->delay_timer)); break;
+                case 0x15: store8(block->delay_timer, blend(m8, vx, load8(block->delay_timer))); break;
+                case 0x18: store8(block->sound_timer, blend(m8, vx, load8(block->sound_timer))); break;
+                case 0x1E:
+                    store16(block->I, load16(block->I) + (__builtin_convertvector(vx, u16v) & m16));
+                    break;
+                case 0x29:
+                    store16(block->I, blend(m16, __builtin_convertvector(vx, u16v) * 5, load16(block->I)));
+                    break;
+                default:
+                    return false;
+            }
+            break;
+        default:
+            return false;
+    }
+
+    store16(block->PC, next);
+    return true;
+}
+
+ALWAYS_INLINE uint16_t opcode_at(const uint8_t * ram, uint16_t pc){
+    return (ram[pc & 0xFFF] << 8) | ram[(pc + 1) & 0xFFF];
+}
+
+// every lane in group runs steps instructions on its own machine , or up to
+// the one that halts it , then it leaves the active lanes. returns the lane
+// instructions run. an idle loop run skips lands where running it out would
+// have , nothing changes keys or timers in between , so it counts in full
+static uint64_t run_scalar(block_t * block, uint32_t group, const interpreter_t * interpreter,
+                           const config_t * config, uint32_t steps){
+    uint64_t executed = 0;
+    for(; group; group &= group - 1){
+        const uint32_t l = __builtin_ctz(group);
+        chip8_t * machine = &block->machines[l];
+        to_machine(block, l);
+        const uint32_t ran = interpreter->run(machine, config, steps);
+        const uint32_t s = machine->state == QUIT ? ran : steps;
+        from_machine(block, l);
+        executed += s;
+        if(machine->state == QUIT){
+            block->active &= ~(1u << l);
+            block->ran[l] = block->steps + s;
+        }
+    }
+    return executed;
+}
+
+// one lockstep instruction for every active lane. the lanes are split into
+// groups sitting on the same opcode , groups of two or more with a vector
+// form go through vector_op , the rest through the interpreter. returns how
+// many lanes went the vector way , *scalar is how many lanes the interpreter ran
+ALWAYS_INLINE uint32_t step_block(block_t * block, const uint8_t * image, const interpreter_t * interpreter,
+                                  const config_t * config, bool chip8_quirks, bool xo_skips, uint64_t * scalar){
+    uint32_t remaining = block->active;
+    uint32_t vectored = 0;
+
+    uint64_t written_any = 0;
+    for(uint32_t l = 0; l < LANE_WIDTH; l++) written_any |= block->written[l];
+
+    while(remaining){
+        const uint32_t leader = __builtin_ctz(remaining);
+        const uint16_t pc = block->PC[leader];
+        const uint16_t image_opcode = opcode_at(image, pc);
+        const uint64_t pages = 1ull << ((pc & 0xFFF) >> LANE_PAGE_SHIFT) |
+                               1ull << (((pc + 1) & 0xFFF) >> LANE_PAGE_SHIFT);
+
+        uint32_t group = 0, written = 0;
+        for(uint32_t l = 0; l < LANE_WIDTH; l++) group |= (uint32_t) (block->PC[l] == pc) << l;
+        group &= remaining;
+        if(written_any & pages)
+            for(uint32_t l = 0; l < LANE_WIDTH; l++)
+                written |= (uint32_t) ((block->written[l] & pages) != 0) << l;
+
+        // lanes that wrote near pc may hold other code there , check them
+        // one by one. if the leader's own code differs from the image the
+        // untouched lanes can't match it either
+        const uint16_t opcode = (written >> leader) & 1 ?
+                                opcode_at(block->machines[leader].ram, pc) : image_opcode;
+        if(opcode != image_opcode) group &= written;
+        for(uint32_t check = group & written & ~(1u << leader); check; check &= check - 1){
+            const uint32_t l = __builtin_ctz(check);
+            if(opcode_at(block->machines[l].ram, pc) != opcode) group &= ~(1u << l);
+        }
+        remaining &= ~group;
+
+        if((group & (group - 1)) && vector_op(block, opcode, group, chip8_quirks, xo_skips)){
+            vectored += __builtin_popcount(group);
+            continue;
+        }
+        *scalar += run_scalar(block, group, interpreter, config, 1);
+    }
+    block->steps++;
+    return vectored;
+}
+
+#define MIN_BURST 16
+#define MAX_BURST_SHIFT 6
+#define SHARE_WINDOW 32 // lockstep steps the vector share is judged over
+#define SCALAR_SHARE 8  // lockstep pays while at most 1 in this many lane instructions is scalar
+
+// every active lane of the block runs steps instructions. lockstep while most
+// lane instructions take the vector path , whether the lanes scattered or
+// they're together on opcodes with no vector form (a scalar step in lockstep
+// also moves the registers in and out of the lane's machine). once more than
+// 1 in SCALAR_SHARE of a window's lane instructions went scalar the lanes
+// run on their own for a burst that doubles each time lockstep keeps failing ,
+// then lockstep is tried again
+static void VECTOR_CLONES run_block(block_t * block, const uint8_t * image, const interpreter_t * interpreter,
+                                    const config_t * config, uint32_t steps,
+                                    uint64_t * vector_steps, uint64_t * scalar_steps){
+    const bool chip8_quirks = config->current_extension == CHIP8;
+    const bool xo_skips = config->current_extension == XOCHIP;
+    uint32_t misses = 0;
+    uint32_t window = 0;
+    uint64_t window_scalar = 0;
+
+    for(uint32_t s = 0; s < steps && block->active;){
+        const uint32_t lanes = __builtin_popcount(block->active);
+        const uint32_t vectored = step_block(block, image, interpreter, config, chip8_quirks, xo_skips, scalar_steps);
+        *vector_steps += vectored;
+        s++;
+
+        window_scalar += lanes - vectored;
+        if(window_scalar * SCALAR_SHARE <= (uint64_t) lanes * SHARE_WINDOW){
+            if(++window == SHARE_WINDOW){
+                window = 0;
+                window_scalar = 0;
+                misses = 0;
+            }
+            continue;
+        }
+        window = 0;
+        window_scalar = 0;
+
+        uint32_t burst = MIN_BURST << (misses < MAX_BURST_SHIFT ? misses : MAX_BURST_SHIFT);
+        if(burst > steps - s) burst = steps - s;
+        misses++;
+
+        *scalar_steps += run_scalar(block, block->active, interpreter, config, burst);
+        block->steps += burst;
+        s += burst;
+    }
+}
+
+void lanes_run(lanes_t * lanes, const config_t * config, uint32_t steps){
+    const interpreter_t * interpreter = select_interpreter(config->current_extension);
+
+    // blocks never touch each other , so each runs all its steps in one go
+    for(uint32_t b = 0; b < lanes->block_count; b++)
+        if(lanes->blocks[b].active)
+            run_block(&lanes->blocks[b], lanes->image, interpreter, config, steps,
+                      &lanes->vector_steps, &lanes->scalar_steps);
+}
+
+void lanes_update_timers(lanes_t * lanes){
+    for(uint32_t b = 0; b < lanes->block_count; b++){
+        block_t * block = &lanes->blocks[b];
+        const u8v delay = load8(block->delay_timer);
+        const u8v sound = load8(block->sound_timer);
+        store8(block->delay_timer, delay + (u8v) (delay != 0)); // -1 where it's running
+        store8(block->sound_timer, sound + (u8v) (sound != 0));
+    }
+}
+
+const chip8_t * lanes_machine(lanes_t * lanes, uint32_t lane){
+    block_t * block = &lanes->blocks[lane / LANE_WIDTH];
+    to_machine(block, lane % LANE_WIDTH);
+    return &block->machines[lane % LANE_WIDTH];
+}
+
+uint64_t lanes_instructions(const lanes_t * lanes, uint32_t lane){
+    const block_t * block = &lanes->blocks[lane / LANE_WIDTH];
+    const uint32_t l = lane % LANE_WIDTH;
+    return (block->active >> l) & 1 ? block->steps : block->ran[l];
+}
+
+void lanes_stats(const lanes_t * lanes, uint64_t * vector_steps, uint64_t * scalar_steps){
+    *vector_steps = lanes->vector_steps;
+    *scalar_steps = lanes->scalar_steps;
+}
@@ -0,0 +1,54 @@
+#ifndef CHIP8_LANES_H
+#define CHIP8_LANES_H
+
+// many copies of one rom stepped in lockstep
+//
+// the registers of LANE_WIDTH machines are kept structure of arrays (V0 of
+// every lane , then V1 , ... , I , PC , timers) so one opcode runs across all
+// the lanes sitting on the same PC with a few vector ops and a mask. lanes that
+// went somewhere else , and opcodes with no vector form (DXYN , keys , BCD ,
+// ...) , drop to the scalar interpreter one lane at a time , and when that's
+// most of the work the lanes run on their own for a while. ram , display ,
+// stack and keys stay in a chip8_t per lane
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "chip8_core.h"
+
+#define LANE_WIDTH 32 // lanes per vector block , one byte register per lane
+
+typedef struct lanes lanes_t;
+
+// room for capacity lanes , NULL when out of memory
+lanes_t * lanes_create(uint32_t capacity);
+void lanes_destroy(lanes_t * lanes);
+
+// start count lanes (<= capacity) on the same rom image , false if it's too big
+bool lanes_load(lanes_t * lanes, uint32_t count, const uint8_t * image, size_t size, const char rom_name []);
+
+// restart the CXNN random numbers of one lane , see seed_chip8
+void lanes_seed(lanes_t * lanes, uint32_t lane, uint32_t seed);
+
+// keypad of one lane , bit per key
+void lanes_set_keys(lanes_t * lanes, uint32_t lane, uint16_t keys);
+
+// every lane runs exactly steps instructions , the same as that many steps of
+// the interpreter on its own machine. a lane that halts (state QUIT) stops
+// there , like the run loops
+void lanes_run(lanes_t * lanes, const config_t * config, uint32_t steps);
+
+// 60hz tick for every lane
+void lanes_update_timers(lanes_t * lanes);
+
+// one lane as a plain machine , its registers copied in from the lanes
+const chip8_t * lanes_machine(lanes_t * lanes, uint32_t lane);
+
+// instructions one lane has run since lanes_load , up to the one that halted it
+uint64_t lanes_instructions(const lanes_t * lanes, uint32_t lane);
+
+// lane instructions run by the vector path and by the scalar fallback so far
+void lanes_stats(const lanes_t * lanes, uint64_t * vector_steps, uint64_t * scalar_steps);
+
+#endif
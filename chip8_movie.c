@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_movie.h"
+
+void movie_init(movie_t * movie, uint32_t seed, uint32_t inst_per_second, extension_t extension){
+    *movie = (movie_t){
+        .seed = seed,
+        .inst_per_second = inst_per_second,
+        .extension = extension,
+    };
+}
+
+void movie_free(movie_t * movie){
+    free(movie->events);
+    movie->events = NULL;
+    movie->count = movie->capacity = 0;
+}
+
+static bool add_event(movie_t * movie, uint32_t frame, uint16_t keys){
+    if(movie->count == movie->capacity){
+        const uint32_t capacity = movie->capacity ? movie->capacity * 2 : 256;
+        key_event_t * events = realloc(movie->events, capacity * sizeof(*events));
+        if(!events) return false;
+        movie->events = events;
+        movie->capacity = capacity;
+    }
+    movie->events[movie->count++] = (key_event_t){ frame, keys };
+    return true;
+}
+
+bool movie_record(movie_t * movie, uint32_t frame, uint16_t keys){
+    movie->frames = frame + 1;
+    const uint16_t held = movie->count ? movie->events[movie->count - 1].keys : 0;
+    return keys == held || add_event(movie, frame, keys);
+}
+
+void movie_truncate(movie_t * movie, uint32_t frame){
+    while(movie->count && movie->events[movie->count - 1].frame >= frame) movie->count--;
+    if(movie->frames > frame) movie->frames = frame;
+}
+
+uint16_t movie_keys(const movie_t * movie, uint32_t frame, uint32_t * cursor){
+    while(*cursor < movie->count && movie->events[*cursor].frame <= frame) ++*cursor;
+    return *cursor ? movie->events[*cursor - 1].keys : 0;
+}
+
+bool movie_save(const movie_t * movie, const char * path){
+    FILE * file = fopen(path, "w");
+    if(!file){
+        fprintf(stderr, "Could not write movie %s\n", path);
+        return false;
+    }
+
+    fprintf(file, "chip8-movie 1\nseed %u\nclock %u\n", movie->seed, movie->inst_per_second);
+    if(movie->cycles_per_frame) fprintf(file, "cycles %u\n", movie->cycles_per_frame);
+    if(movie->display_wait) fprintf(file, "display_wait 1\n");
+    fprintf(file, "quirks %s\n", extension_name(movie->extension));
+    for(uint32_t i = 0; i < movie->count; i++)
+        fprintf(file, "%u %04X\n", movie->events[i].frame, movie->events[i].keys);
+    fprintf(file, "end %u\n", movie->frames);
+
+    const bool ok = !ferror(file);
+    if(fclose(file) != 0 || !ok){
+        fprintf(stderr, "Could not write movie %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool movie_load(movie_t * movie, const char * path){
+    FILE * file = fopen(path, "r");
+    if(!file){
+        fprintf(stderr, "Movie %s doesn't exist\n", path);
+        return false;
+    }
+
+    char line[128];
+    uint32_t line_no = 0;
+    bool has_end = false;
+    movie->count = 0;
+
+    while(fgets(line, sizeof line, file)){
+        line_no++;
+        char * text = line + strspn(line, " \t");
+        if(*text == '#' || *text == '\n' || *text == '\0') continue;
+
+        unsigned long frame, keys;
+        char word[16], arg[16];
+        bool ok;
+
+        if(sscanf(text, "%lu %lx", &frame, &keys) == 2){
+            ok = keys <= 0xFFFF && frame < UINT32_MAX &&
+                 (!movie->count || frame >= movie->events[movie->count - 1].frame);
+            if(ok && !add_event(movie, frame, keys)){
+                fprintf(stderr, "Out of memory for movie %s\n", path);
+                fclose(file);
+                return false;
+            }
+        }
+        else if(sscanf(text, "%15s %15s", word, arg) == 2){
+            const unsigned long value = strtoul(arg, NULL, 0);
+            ok = true;
+            if(strcmp(word, "seed") == 0) movie->seed = value;
+            else if(strcmp(word, "clock") == 0) movie->inst_per_second = value;
+            else if(strcmp(word, "cycles") == 0) movie->cycles_per_frame = value;
+            else if(strcmp(word, "display_wait") == 0) movie->display_wait = value != 0;
+            else if(strcmp(word, "quirks") == 0) ok = parse_extension(arg, &movie->extension);
+            else if(strcmp(word, "end") == 0){
+                movie->frames = value;
+                has_end = true;
+            }
+            else ok = strcmp(word, "chip8-movie") == 0 && value == 1;
+        }
+        else ok = false;
+
+        if(!ok){
+            fprintf(stderr, "%s:%u: bad movie line\n", path, line_no);
+            fclose(file);
+            return false;
+        }
+    }
+    fclose(file);
+
+    if(!has_end) movie->frames = movie->count ? movie->events[movie->count - 1].frame + 1 : 0;
+    return true;
+}
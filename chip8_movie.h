@@ -0,0 +1,79 @@
+#ifndef CHIP8_MOVIE_H
+#define CHIP8_MOVIE_H
+
+// input movies , everything needed to replay a run exactly : the CXNN seed ,
+// the clock , the quirks and every keypad change with the frame (60hz tick)
+// it happened on. a frame runs its share of the clock then ticks the timers ,
+// see run_frame
+//
+// text , one line each :
+//     chip8-movie 1
+//     seed <n>
+//     clock <instructions per second>
+//     cycles <cycles per frame>    only with the cycle schedule
+//     display_wait 1               only with the display wait
+//     quirks <chip8 | schip | xochip>
+//     <frame> <hex key mask>       keys held from that frame on , frames in order
+//     end <frames>
+// # starts a comment. every line but the key changes is optional , a plain
+// list of "<frame> <mask>" lines is a movie too
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "chip8_core.h"
+
+typedef struct{
+    uint32_t frame;
+    uint16_t keys; // bit per key
+} key_event_t;
+
+typedef struct{
+    uint32_t seed;
+    uint32_t inst_per_second;
+    extension_t extension;
+    uint32_t cycles_per_frame; // config_t's , 0 = the clock counts instructions
+    bool display_wait;
+    uint32_t frames;     // length , keys of the last change hold until the end
+    key_event_t * events;
+    uint32_t count;
+    uint32_t capacity;
+} movie_t;
+
+// empty movie with these settings , loading a file only replaces the ones it has
+void movie_init(movie_t * movie, uint32_t seed, uint32_t inst_per_second, extension_t extension);
+void movie_free(movie_t * movie);
+
+// keys held during frame , only a change is stored. frames go up by one at a
+// time , or back after a movie_truncate. false when out of memory
+bool movie_record(movie_t * movie, uint32_t frame, uint16_t keys);
+
+// forget frame and everything after it , e.g. after rewinding
+void movie_truncate(movie_t * movie, uint32_t frame);
+
+// keys held during frame , for frames asked in order. *cursor starts at 0
+uint16_t movie_keys(const movie_t * movie, uint32_t frame, uint32_t * cursor);
+
+// false (and a message) when the file can't be written or read
+bool movie_save(const movie_t * movie, const char * path);
+bool movie_load(movie_t * movie, const char * path);
+
+// instructions the next frame runs at inst_per_second , *acc carries the
+// remainder so a second is exactly inst_per_second. starts at 0
+static inline uint32_t frame_budget(uint32_t inst_per_second, uint32_t * acc){
+    *acc += inst_per_second;
+    const uint32_t budget = *acc / 60;
+    *acc %= 60;
+    return budget;
+}
+
+// one frame of config's schedule , the timers are the caller's. *acc is
+// frame_budget's , the cycle schedule carries its remainder in the machine.
+// returns instructions executed
+static inline uint32_t run_frame(const interpreter_t * interpreter, chip8_t * chip8, const config_t * config,
+                                 uint32_t * acc){
+    if(config->cycles_per_frame) return interpreter->run_cycles(chip8, config, config->cycles_per_frame);
+    return interpreter->run(chip8, config, frame_budget(config->inst_per_second, acc));
+}
+
+#endif
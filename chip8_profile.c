@@ -0,0 +1,115 @@
+// report side of the CHIP8_PROFILE instrumentation , empty without it
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "chip8_profile.h"
+
+#ifdef CHIP8_PROFILE
+
+#include <time.h>
+
+profile_t profile;
+
+#define TOP_PCS 16
+
+uint64_t profile_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// 8XY4 , FX33 , 00E0 ... from the group and sub op profile_instruction used ,
+// one name per counter so the json keys stay unique
+static void op_name(char name[8], uint8_t group, uint8_t sub){
+    static const char * const fixed[16] = {
+        NULL, "1NNN", "2NNN", "3XNN", "4XNN", NULL, "6XNN", "7XNN",
+        NULL, "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", NULL, NULL,
+    };
+
+    if(group == 0x0 && sub == 0x00) snprintf(name, 8, "0NNN");
+    else if(group == 0x0 && sub == 0xC0) snprintf(name, 8, "00CN");
+    else if(group == 0x0 && sub == 0xD0) snprintf(name, 8, "00DN");
+    else if(group == 0x0) snprintf(name, 8, "00%02X", sub);
+    else if(group == 0x5) snprintf(name, 8, "5XY%X", sub);
+    else if(group == 0x8) snprintf(name, 8, "8XY%X", sub);
+    else if(group == 0xE) snprintf(name, 8, "EX%02X", sub);
+    else if(group == 0xF) snprintf(name, 8, "FX%02X", sub);
+    else snprintf(name, 8, "%s", fixed[group]);
+}
+
+static double average(uint64_t total, uint64_t calls){
+    return calls ? (double) total / calls : 0.0;
+}
+
+void profile_report(FILE * text, const char * json_path){
+    uint64_t total = 0;
+    for(int group = 0; group < 16; group++)
+        for(int sub = 0; sub < 256; sub++) total += profile.ops[group][sub];
+
+    // hottest addresses , a small insertion sort is plenty
+    uint16_t top[TOP_PCS];
+    int top_count = 0;
+    for(uint16_t pc = 0; pc < 4096; pc++){
+        if(!profile.pc[pc]) continue;
+        int at = top_count < TOP_PCS ? top_count++ : TOP_PCS;
+        while(at > 0 && profile.pc[top[at - 1]] < profile.pc[pc]){
+            if(at < TOP_PCS) top[at] = top[at - 1];
+            at--;
+        }
+        if(at < TOP_PCS) top[at] = pc;
+    }
+
+    char name[8];
+
+    fprintf(text, "==== chip8 profile ====\n");
+    fprintf(text, "instructions  %llu\n", (unsigned long long) total);
+    fprintf(text, "opcode        count      share\n");
+    for(int group = 0; group < 16; group++)
+        for(int sub = 0; sub < 256; sub++){
+            if(!profile.ops[group][sub]) continue;
+            op_name(name, group, sub);
+            fprintf(text, "  %-6s %12llu %8.2f%%\n", name, (unsigned long long) profile.ops[group][sub],
+                    100.0 * profile.ops[group][sub] / total);
+        }
+    fprintf(text, "hottest PCs\n");
+    for(int i = 0; i < top_count; i++)
+        fprintf(text, "  %03X   %12llu %8.2f%%\n", top[i], (unsigned long long) profile.pc[top[i]],
+                100.0 * profile.pc[top[i]] / total);
+    fprintf(text, "DXYN          %llu calls , %.0f ns avg\n", (unsigned long long) profile.dxyn_calls,
+            average(profile.dxyn_ns, profile.dxyn_calls));
+    fprintf(text, "updateScreen  %llu calls , %.0f ns avg\n", (unsigned long long) profile.render_calls,
+            average(profile.render_ns, profile.render_calls));
+
+    if(!json_path) return;
+
+    FILE * json = fopen(json_path, "w");
+    if(!json){
+        fprintf(stderr, "Could not write profile to %s\n", json_path);
+        return;
+    }
+
+    fprintf(json, "{\n  \"instructions\": %llu,\n  \"opcodes\": {", (unsigned long long) total);
+    const char * sep = "";
+    for(int group = 0; group < 16; group++)
+        for(int sub = 0; sub < 256; sub++){
+            if(!profile.ops[group][sub]) continue;
+            op_name(name, group, sub);
+            fprintf(json, "%s\n    \"%s\": %llu", sep, name, (unsigned long long) profile.ops[group][sub]);
+            sep = ",";
+        }
+    fprintf(json, "\n  },\n  \"pc\": {");
+    sep = "";
+    for(uint16_t pc = 0; pc < 4096; pc++){
+        if(!profile.pc[pc]) continue;
+        fprintf(json, "%s\n    \"0x%03X\": %llu", sep, pc, (unsigned long long) profile.pc[pc]);
+        sep = ",";
+    }
+    fprintf(json, "\n  },\n");
+    fprintf(json, "  \"dxyn\": { \"calls\": %llu, \"total_ns\": %llu },\n",
+            (unsigned long long) profile.dxyn_calls, (unsigned long long) profile.dxyn_ns);
+    fprintf(json, "  \"update_screen\": { \"calls\": %llu, \"total_ns\": %llu }\n}\n",
+            (unsigned long long) profile.render_calls, (unsigned long long) profile.render_ns);
+    fclose(json);
+}
+
+#endif
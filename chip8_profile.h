@@ -0,0 +1,62 @@
+#ifndef CHIP8_PROFILE_H
+#define CHIP8_PROFILE_H
+
+// opt in instrumentation , build with -DCHIP8_PROFILE (make PROFILE=1).
+// without it every PROFILE_ hook is an empty statement and costs nothing.
+// counts are for instructions dispatched by the interpreters' step , jit
+// blocks don't go through it
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef CHIP8_PROFILE
+
+typedef struct{
+    uint64_t ops[16][256];  // [opcode >> 12][sub op] executions
+    uint64_t pc[4096];      // executions per address
+    uint64_t dxyn_ns;
+    uint64_t dxyn_calls;
+    uint64_t render_ns;     // updateScreen
+    uint64_t render_calls;
+} profile_t;
+
+extern profile_t profile;
+
+uint64_t profile_now_ns(void);
+
+// text report to a stream , plus the same as json when json_path isn't NULL
+void profile_report(FILE * text, const char * json_path);
+
+// sub op is N for 5XYN and 8XYN and NN for 0 , E and F , the other groups
+// have one op. group 0 folds into one sub op per opcode : 00CN and 00DN at C0
+// and D0 , machine code calls (0NNN) at 0
+static inline uint8_t profile_group0(uint8_t nn){
+    if((nn & 0xF0) == 0xC0 || (nn & 0xF0) == 0xD0) return nn & 0xF0;
+    if(nn == 0xE0 || nn == 0xEE || nn >= 0xFB) return nn;
+    return 0;
+}
+
+static inline void profile_instruction(uint16_t opcode, uint16_t pc){
+    const uint8_t group = opcode >> 12;
+    const uint8_t sub = group == 0x5 || group == 0x8 ? (opcode & 0x0F) :
+                        group == 0x0 ? profile_group0(opcode & 0xFF) :
+                        group >= 0xE ? (opcode & 0xFF) : 0;
+    profile.ops[group][sub]++;
+    profile.pc[pc & 0xFFF]++;
+}
+
+#define PROFILE_INSTRUCTION(opcode, pc) profile_instruction((opcode), (pc))
+#define PROFILE_BEGIN(name) const uint64_t profile_start_##name = profile_now_ns()
+#define PROFILE_END(name) (profile.name##_ns += profile_now_ns() - profile_start_##name, profile.name##_calls++)
+#define PROFILE_REPORT(text, json_path) profile_report((text), (json_path))
+
+#else
+
+#define PROFILE_INSTRUCTION(opcode, pc) ((void)0)
+#define PROFILE_BEGIN(name) ((void)0)
+#define PROFILE_END(name) ((void)0)
+#define PROFILE_REPORT(text, json_path) ((void)0)
+
+#endif
+
+#endif
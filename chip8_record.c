@@ -0,0 +1,479 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "chip8_record.h"
+
+#define VIDEO_WIDTH DISPLAY_WIDTH
+#define VIDEO_HEIGHT DISPLAY_HEIGHT
+#define VIDEO_PIXELS (VIDEO_WIDTH * VIDEO_HEIGHT)
+#define WRITER_NAP_NS 1000000 // the writer's sleep when both rings are empty
+
+#define GIF_CLEAR 4 // lzw codes after the 4 colors
+#define GIF_END 5
+#define GIF_MIN_DELAY 2 // centiseconds , players show anything shorter as 1/10 s
+
+typedef struct{
+    uint64_t display[DISPLAY_HEIGHT][DISPLAY_WORDS];
+    uint64_t display2[DISPLAY_HEIGHT][DISPLAY_WORDS];
+    uint64_t index; // frame number , counting dropped ones
+    bool hires;
+} frame_slot_t;
+
+// lzw codes go out least significant bit first , in sub-blocks of up to 255 bytes
+typedef struct{
+    uint8_t block[255];
+    uint32_t len;
+    uint32_t bits;
+    uint32_t count;
+} gif_bits_t;
+
+struct recorder{
+    // emulation thread only
+    _Alignas(64) atomic_uint frame_tail;
+    atomic_uint trace_tail;
+    uint32_t frame_head_seen; // last head read , the ring is only re-checked when it looks full
+    uint32_t trace_head_seen;
+    uint8_t next_flags;       // for the next trace record
+    record_stats_t stats;
+
+    // writer thread only
+    _Alignas(64) atomic_uint frame_head;
+    atomic_uint trace_head;
+    uint8_t pixels[VIDEO_HEIGHT][VIDEO_WIDTH]; // palette index per pixel of the newest frame
+    uint8_t * encoded;         // y4m / raw bytes of the last frame , repeated over drops
+    uint32_t encoded_size;
+    uint64_t next_index;       // frame number the video expects next
+    bool any_frame;
+    uint8_t gif_pending[VIDEO_HEIGHT][VIDEO_WIDTH]; // gif frame not written yet , it may still merge
+    uint64_t gif_start;        // frame number gif_pending went up on
+    uint16_t gif_next[4096][4]; // lzw string table , code + color -> code , 0 = none yet
+    gif_bits_t gif_bits;
+    bool write_error;
+    uint64_t end_index;        // frames handed over in all , set before stop
+
+    // fixed after create
+    frame_slot_t * frames;
+    trace_record_t * trace;
+    uint32_t frame_mask;
+    uint32_t trace_mask;
+    FILE * video;
+    FILE * trace_file;
+    const char * video_path;
+    const char * trace_path;
+    video_format_t format;
+    uint32_t palette[4];
+    uint8_t yuv[4][3];
+    atomic_bool stop;
+    pthread_t writer;
+};
+
+static uint32_t round_up_pow2(uint32_t n){
+    return n <= 1 ? 1 : 1u << (32 - __builtin_clz(n - 1));
+}
+
+video_format_t video_format(const char * path){
+    const char * dot = strrchr(path, '.');
+    if(dot && strcmp(dot, ".y4m") == 0) return VIDEO_Y4M;
+    if(dot && strcmp(dot, ".gif") == 0) return VIDEO_GIF;
+    return VIDEO_RAW;
+}
+
+static void put_bytes(recorder_t * rec, FILE * file, const void * bytes, size_t size){
+    if(!rec->write_error && fwrite(bytes, 1, size, file) != size) rec->write_error = true;
+}
+
+static void put_u16(uint8_t * p, uint16_t v){
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void gif_flush_block(recorder_t * rec){
+    gif_bits_t * b = &rec->gif_bits;
+    if(!b->len) return;
+    const uint8_t len = b->len;
+    put_bytes(rec, rec->video, &len, 1);
+    put_bytes(rec, rec->video, b->block, b->len);
+    b->len = 0;
+}
+
+static void gif_put_code(recorder_t * rec, uint32_t code, uint32_t size){
+    gif_bits_t * b = &rec->gif_bits;
+    b->bits |= code << b->count;
+    b->count += size;
+    while(b->count >= 8){
+        b->block[b->len++] = b->bits & 0xFF;
+        if(b->len == sizeof(b->block)) gif_flush_block(rec);
+        b->bits >>= 8;
+        b->count -= 8;
+    }
+}
+
+static void gif_header(recorder_t * rec){
+    uint8_t header[13 + 12 + 19] = "GIF89a";
+    put_u16(&header[6], VIDEO_WIDTH);
+    put_u16(&header[8], VIDEO_HEIGHT);
+    header[10] = 0x91; // global color table of 4 , 2 bits of color resolution
+    for(uint32_t i = 0; i < 4; i++){
+        header[13 + 3 * i] = rec->palette[i] >> 24;
+        header[14 + 3 * i] = rec->palette[i] >> 16;
+        header[15 + 3 * i] = rec->palette[i] >> 8;
+    }
+    // loop forever
+    memcpy(&header[25], "\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 19);
+    put_bytes(rec, rec->video, header, sizeof(header));
+}
+
+// gif_pending as one image shown for delay centiseconds
+static void gif_image(recorder_t * rec, uint32_t delay){
+    uint8_t head[8 + 10 + 1] = { 0x21, 0xF9, 0x04, 0x00 };
+    put_u16(&head[4], delay);
+    head[8] = 0x2C;
+    put_u16(&head[13], VIDEO_WIDTH);
+    put_u16(&head[15], VIDEO_HEIGHT);
+    head[18] = 2; // lzw minimum code size
+    put_bytes(rec, rec->video, head, sizeof(head));
+
+    // a trie of the strings seen so far , codes 6 up
+    const uint8_t * p = &rec->gif_pending[0][0];
+    uint32_t size = 3, last = GIF_END;
+    memset(rec->gif_next, 0, sizeof(rec->gif_next));
+    gif_put_code(rec, GIF_CLEAR, size);
+
+    uint32_t code = p[0];
+    for(uint32_t i = 1; i < VIDEO_PIXELS; i++){
+        const uint8_t color = p[i];
+        if(rec->gif_next[code][color]){
+            code = rec->gif_next[code][color];
+            continue;
+        }
+        gif_put_code(rec, code, size);
+        rec->gif_next[code][color] = ++last;
+        if(last >= (1u << size)) size++;
+        if(last == 4095){
+            gif_put_code(rec, GIF_CLEAR, size);
+            memset(rec->gif_next, 0, sizeof(rec->gif_next));
+            size = 3;
+            last = GIF_END;
+        }
+        code = color;
+    }
+    gif_put_code(rec, code, size);
+    gif_put_code(rec, GIF_END, size);
+    if(rec->gif_bits.count) gif_put_code(rec, 0, 8 - rec->gif_bits.count);
+    gif_flush_block(rec);
+    const uint8_t end = 0;
+    put_bytes(rec, rec->video, &end, 1);
+}
+
+static uint64_t centiseconds(uint64_t frame){
+    return frame * 100 / 60;
+}
+
+// a new picture at frame index , the pending one goes out once it has been up
+// long enough , otherwise the new one takes its place
+static void gif_frame(recorder_t * rec, uint64_t index){
+    if(!rec->any_frame){
+        memcpy(rec->gif_pending, rec->pixels, sizeof(rec->pixels));
+        rec->gif_start = index;
+        return;
+    }
+    if(memcmp(rec->gif_pending, rec->pixels, sizeof(rec->pixels)) == 0) return;
+
+    const uint64_t shown = centiseconds(index) - centiseconds(rec->gif_start);
+    if(shown >= GIF_MIN_DELAY){
+        gif_image(rec, shown);
+        rec->gif_start = index;
+    }
+    memcpy(rec->gif_pending, rec->pixels, sizeof(rec->pixels));
+}
+
+static void gif_finish(recorder_t * rec){
+    if(rec->any_frame){
+        const uint64_t shown = centiseconds(rec->end_index) - centiseconds(rec->gif_start);
+        gif_image(rec, shown > GIF_MIN_DELAY ? shown : GIF_MIN_DELAY);
+    }
+    const uint8_t trailer = 0x3B;
+    put_bytes(rec, rec->video, &trailer, 1);
+}
+
+static void yuv_palette(recorder_t * rec){
+    for(uint32_t i = 0; i < 4; i++){
+        const int r = (rec->palette[i] >> 24) & 0xFF, g = (rec->palette[i] >> 16) & 0xFF, b = (rec->palette[i] >> 8) & 0xFF;
+        rec->yuv[i][0] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        rec->yuv[i][1] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        rec->yuv[i][2] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+}
+
+static void encode_frame(recorder_t * rec){
+    const uint8_t * p = &rec->pixels[0][0];
+    uint8_t * out = rec->encoded;
+
+    if(rec->format == VIDEO_Y4M){
+        memcpy(out, "FRAME\n", 6);
+        out += 6;
+        for(uint32_t plane = 0; plane < 3; plane++)
+            for(uint32_t i = 0; i < VIDEO_PIXELS; i++) *out++ = rec->yuv[p[i]][plane];
+    }
+    else {
+        for(uint32_t i = 0; i < VIDEO_PIXELS; i++){
+            const uint32_t color = rec->palette[p[i]];
+            *out++ = color >> 24;
+            *out++ = color >> 16;
+            *out++ = color >> 8;
+            *out++ = color;
+        }
+    }
+}
+
+// a frame slot to palette indexes at 128x64 , lores doubled up
+static void frame_pixels(recorder_t * rec, const frame_slot_t * slot){
+    const uint32_t shift = slot->hires ? 0 : 1;
+    for(uint32_t y = 0; y < VIDEO_HEIGHT; y++){
+        const uint32_t sy = y >> shift;
+        for(uint32_t x = 0; x < VIDEO_WIDTH; x++){
+            const uint32_t sx = x >> shift;
+            const uint32_t bit = 63 - (sx & 63);
+            rec->pixels[y][x] = ((slot->display[sy][sx >> 6] >> bit) & 1) |
+                                ((slot->display2[sy][sx >> 6] >> bit) & 1) << 1;
+        }
+    }
+}
+
+static void write_frame(recorder_t * rec, const frame_slot_t * slot){
+    frame_pixels(rec, slot);
+
+    if(rec->format == VIDEO_GIF) gif_frame(rec, slot->index);
+    else {
+        // frames the ring dropped show the last one again
+        if(rec->any_frame)
+            for(; rec->next_index < slot->index; rec->next_index++)
+                put_bytes(rec, rec->video, rec->encoded, rec->encoded_size);
+        encode_frame(rec);
+        put_bytes(rec, rec->video, rec->encoded, rec->encoded_size);
+    }
+    rec->any_frame = true;
+    rec->next_index = slot->index + 1;
+}
+
+// everything queued so far , false when there was nothing
+static bool drain(recorder_t * rec){
+    bool busy = false;
+
+    if(rec->trace_file){
+        const uint32_t head = atomic_load_explicit(&rec->trace_head, memory_order_relaxed);
+        const uint32_t tail = atomic_load_explicit(&rec->trace_tail, memory_order_acquire);
+        if(head != tail){
+            // up to the end of the ring , the rest goes next round
+            const uint32_t start = head & rec->trace_mask;
+            uint32_t count = tail - head;
+            if(count > rec->trace_mask + 1 - start) count = rec->trace_mask + 1 - start;
+            put_bytes(rec, rec->trace_file, &rec->trace[start], count * sizeof(trace_record_t));
+            atomic_store_explicit(&rec->trace_head, head + count, memory_order_release);
+            busy = true;
+        }
+    }
+
+    if(rec->video){
+        uint32_t head = atomic_load_explicit(&rec->frame_head, memory_order_relaxed);
+        const uint32_t tail = atomic_load_explicit(&rec->frame_tail, memory_order_acquire);
+        for(; head != tail; head++){
+            write_frame(rec, &rec->frames[head & rec->frame_mask]);
+            atomic_store_explicit(&rec->frame_head, head + 1, memory_order_release);
+            busy = true;
+        }
+    }
+    return busy;
+}
+
+static void * writer_thread(void * data){
+    recorder_t * rec = data;
+    const struct timespec nap = { .tv_nsec = WRITER_NAP_NS };
+
+    for(;;){
+        // read before draining , so whatever was queued before the stop is written
+        const bool stop = atomic_load_explicit(&rec->stop, memory_order_acquire);
+        if(drain(rec)) continue;
+        if(stop) break;
+        nanosleep(&nap, NULL);
+    }
+
+    // frames dropped at the end still take their time
+    if(rec->video && rec->format == VIDEO_GIF) gif_finish(rec);
+    else if(rec->video && rec->any_frame)
+        for(; rec->next_index < rec->end_index; rec->next_index++)
+            put_bytes(rec, rec->video, rec->encoded, rec->encoded_size);
+    return NULL;
+}
+
+recorder_t * recorder_create(const char * video_path, const char * trace_path, const uint32_t palette[4],
+                             uint32_t frame_slots, uint32_t trace_slots){
+    recorder_t * rec = aligned_alloc(64, (sizeof(*rec) + 63) & ~(size_t) 63);
+    if(!rec){
+        fprintf(stderr, "Out of memory for the recorder\n");
+        return NULL;
+    }
+    memset(rec, 0, sizeof(*rec));
+    atomic_init(&rec->frame_tail, 0);
+    atomic_init(&rec->trace_tail, 0);
+    atomic_init(&rec->frame_head, 0);
+    atomic_init(&rec->trace_head, 0);
+    atomic_init(&rec->stop, false);
+    memcpy(rec->palette, palette, sizeof(rec->palette));
+    yuv_palette(rec);
+    rec->video_path = video_path;
+    rec->trace_path = trace_path;
+    rec->frame_mask = round_up_pow2(frame_slots ? frame_slots : RECORD_DEFAULT_FRAMES) - 1;
+    rec->trace_mask = round_up_pow2(trace_slots ? trace_slots : RECORD_DEFAULT_TRACE) - 1;
+
+    bool ok = true;
+    if(video_path){
+        rec->format = video_format(video_path);
+        rec->encoded_size = rec->format == VIDEO_Y4M ? 6 + 3 * VIDEO_PIXELS : 4 * VIDEO_PIXELS;
+        rec->frames = malloc((rec->frame_mask + 1) * sizeof(frame_slot_t));
+        rec->encoded = malloc(rec->encoded_size);
+        rec->video = fopen(video_path, "wb");
+        if(!rec->frames || !rec->encoded){
+            fprintf(stderr, "Out of memory for the recorder\n");
+            ok = false;
+        }
+        else if(!rec->video){
+            fprintf(stderr, "Could not write video %s\n", video_path);
+            ok = false;
+        }
+        else if(rec->format == VIDEO_Y4M)
+            fprintf(rec->video, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C444\n", VIDEO_WIDTH, VIDEO_HEIGHT);
+        else if(rec->format == VIDEO_GIF) gif_header(rec);
+    }
+    if(ok && trace_path){
+        rec->trace = malloc((rec->trace_mask + 1) * sizeof(trace_record_t));
+        rec->trace_file = fopen(trace_path, "wb");
+        if(!rec->trace){
+            fprintf(stderr, "Out of memory for the recorder\n");
+            ok = false;
+        }
+        else if(!rec->trace_file){
+            fprintf(stderr, "Could not write trace %s\n", trace_path);
+            ok = false;
+        }
+        else {
+            uint8_t header[16] = "CH8TRACE";
+            header[8] = 1; // version
+            header[12] = sizeof(trace_record_t);
+            put_bytes(rec, rec->trace_file, header, sizeof(header));
+        }
+    }
+    if(ok && pthread_create(&rec->writer, NULL, writer_thread, rec) != 0){
+        fprintf(stderr, "Could not start the recorder thread\n");
+        ok = false;
+    }
+
+    if(!ok){
+        if(rec->video) fclose(rec->video);
+        if(rec->trace_file) fclose(rec->trace_file);
+        free(rec->frames);
+        free(rec->encoded);
+        free(rec->trace);
+        free(rec);
+        return NULL;
+    }
+    return rec;
+}
+
+void recorder_frame(recorder_t * rec, const chip8_t * chip8){
+    const uint64_t index = rec->stats.frames++;
+    rec->next_flags |= TRACE_NEW_FRAME;
+    if(!rec->video) return;
+
+    const uint32_t tail = atomic_load_explicit(&rec->frame_tail, memory_order_relaxed);
+    if(tail - rec->frame_head_seen > rec->frame_mask){
+        rec->frame_head_seen = atomic_load_explicit(&rec->frame_head, memory_order_acquire);
+        if(tail - rec->frame_head_seen > rec->frame_mask){
+            rec->stats.frames_dropped++;
+            return;
+        }
+    }
+
+    frame_slot_t * slot = &rec->frames[tail & rec->frame_mask];
+    memcpy(slot->display, chip8->display, sizeof(slot->display));
+    memcpy(slot->display2, chip8->display2, sizeof(slot->display2));
+    slot->hires = chip8->hires;
+    slot->index = index;
+    atomic_store_explicit(&rec->frame_tail, tail + 1, memory_order_release);
+}
+
+void recorder_trace(recorder_t * rec, const chip8_t * chip8){
+    if(!rec->trace_file) return;
+    rec->stats.trace++;
+
+    const uint32_t tail = atomic_load_explicit(&rec->trace_tail, memory_order_relaxed);
+    if(tail - rec->trace_head_seen > rec->trace_mask){
+        rec->trace_head_seen = atomic_load_explicit(&rec->trace_head, memory_order_acquire);
+        if(tail - rec->trace_head_seen > rec->trace_mask){
+            rec->stats.trace_dropped++;
+            rec->next_flags |= TRACE_DROPPED;
+            return;
+        }
+    }
+
+    const uint8_t * ram = chip8_ram(chip8);
+    const uint32_t mask = ram_size(chip8) - 1;
+    trace_record_t * record = &rec->trace[tail & rec->trace_mask];
+    record->PC = chip8->PC;
+    record->opcode = (ram[chip8->PC & mask] << 8) | ram[(chip8->PC + 1) & mask];
+    record->I = chip8->I;
+    record->SP = chip8->SP;
+    record->flags = rec->next_flags;
+    memcpy(record->V, chip8->V, sizeof(record->V));
+    rec->next_flags = 0;
+    atomic_store_explicit(&rec->trace_tail, tail + 1, memory_order_release);
+}
+
+uint32_t recorder_run(recorder_t * rec, const interpreter_t * interpreter, chip8_t * chip8,
+                      const config_t * config, uint32_t count){
+    chip8->idle_cycle = 0;
+    uint8_t idle = 0;
+    uint32_t i = 0;
+    // a halt leaves PC on the halting opcode , stepping on would only trace it again
+    while(i < count && chip8->state != QUIT){
+        recorder_trace(rec, chip8);
+        interpreter->step(chip8, config);
+        i++;
+        if(chip8->idle_cycle) idle = chip8->idle_cycle;
+    }
+    chip8->idle_cycle = idle;
+    return i;
+}
+
+bool recorder_tracing(const recorder_t * rec){
+    return rec && rec->trace_file != NULL;
+}
+
+void recorder_stats(const recorder_t * rec, record_stats_t * stats){
+    *stats = rec->stats;
+}
+
+bool recorder_destroy(recorder_t * rec){
+    if(!rec) return true;
+    rec->end_index = rec->stats.frames;
+    atomic_store_explicit(&rec->stop, true, memory_order_release);
+    pthread_join(rec->writer, NULL);
+
+    if(rec->video && fclose(rec->video) != 0) rec->write_error = true;
+    if(rec->trace_file && fclose(rec->trace_file) != 0) rec->write_error = true;
+    const bool ok = !rec->write_error;
+    if(!ok) fprintf(stderr, "Could not write the recording (%s%s%s)\n", rec->video_path ? rec->video_path : "",
+                    rec->video_path && rec->trace_path ? " , " : "", rec->trace_path ? rec->trace_path : "");
+
+    free(rec->frames);
+    free(rec->encoded);
+    free(rec->trace);
+    free(rec);
+    return ok;
+}
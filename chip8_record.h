@@ -0,0 +1,89 @@
+#ifndef CHIP8_RECORD_H
+#define CHIP8_RECORD_H
+
+// frame and instruction trace recorder , no SDL in here
+//
+// the emulation thread copies each finished frame (and with a trace every
+// instruction's PC , opcode , I and V) into preallocated rings , a background
+// writer thread encodes them. when the writer falls behind a full ring drops
+// the newest entry and counts it , the emulation never waits on the disk.
+//
+// video is 128x64 at 60 fps , lores frames are doubled up. y4m (yuv 4:4:4) and
+// raw (rgba , 4 bytes a pixel) get a frame for every frame , a dropped one
+// repeats the one before so the timing holds. gif keeps a 4 color palette ,
+// only writes a frame when the picture changed and merges changes less than
+// 2/100 s apart , what players can show.
+//
+// a trace is an 16 byte header ("CH8TRACE" , version , record size , all
+// little endian) then one trace_record_t per instruction , as it was about
+// to run
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "chip8_core.h"
+
+typedef enum{
+    VIDEO_Y4M,
+    VIDEO_RAW,
+    VIDEO_GIF,
+} video_format_t;
+
+#define TRACE_DROPPED 1   // trace_record_t flags , records were dropped right before this one
+#define TRACE_NEW_FRAME 2 // first instruction after a frame
+
+typedef struct{
+    uint16_t PC;
+    uint16_t opcode;
+    uint16_t I;
+    uint8_t SP;
+    uint8_t flags;
+    uint8_t V[16];
+} trace_record_t;
+
+_Static_assert(sizeof(trace_record_t) == 24, "trace records are written as they are");
+
+#define RECORD_DEFAULT_FRAMES 256        // frames in flight , about 4 seconds
+#define RECORD_DEFAULT_TRACE (1u << 18)  // trace records in flight , 6 MB
+
+typedef struct{
+    uint64_t frames;         // handed to the recorder
+    uint64_t frames_dropped; // of them , lost to a full ring
+    uint64_t trace;
+    uint64_t trace_dropped;
+} record_stats_t;
+
+typedef struct recorder recorder_t;
+
+// video format by file name , .y4m , .gif , anything else is raw
+video_format_t video_format(const char * path);
+
+// video_path and trace_path may be NULL , palette picks the video colors (see
+// config_t). ring sizes are rounded up to powers of two , 0 = default. NULL
+// (and a message) when a file can't be created or memory is short
+recorder_t * recorder_create(const char * video_path, const char * trace_path, const uint32_t palette[4],
+                             uint32_t frame_slots, uint32_t trace_slots);
+
+// emulation thread : a frame finished , once per 60hz tick
+void recorder_frame(recorder_t * recorder, const chip8_t * chip8);
+
+// emulation thread : the instruction at PC is about to run
+void recorder_trace(recorder_t * recorder, const chip8_t * chip8);
+
+// emulation thread : count instructions with interpreter , each traced first.
+// unlike interpreter->run idle loops are run out , every instruction shows up
+// in the trace , but idle_cycle is still set for the caller. stops early when
+// the program quits , returns instructions executed
+uint32_t recorder_run(recorder_t * recorder, const interpreter_t * interpreter, chip8_t * chip8,
+                      const config_t * config, uint32_t count);
+
+// whether a trace is being written (false for NULL) , recorder_run is only needed then
+bool recorder_tracing(const recorder_t * recorder);
+
+void recorder_stats(const recorder_t * recorder, record_stats_t * stats);
+
+// writes out what is still queued , stops the writer and closes the files.
+// false (and a message) if a write failed
+bool recorder_destroy(recorder_t * recorder);
+
+#endif
@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_rewind.h"
+
+// everything that makes up the machine between two frames apart from ram ,
+// which comes before it in a snapshot (4 KB or xo-chip's 64 KB). keys are
+// input , not state , and idle_cycle is worked out again by the next run
+typedef struct{
+    uint64_t display[DISPLAY_HEIGHT][DISPLAY_WORDS];
+    uint64_t display2[DISPLAY_HEIGHT][DISPLAY_WORDS];
+    uint16_t stack[12];
+    uint8_t V[16];
+    uint8_t flags[16];
+    uint16_t I;
+    uint16_t PC;
+    uint8_t stack_depth;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t wait_key;
+    uint32_t rng;
+    uint32_t cycle_debt;
+    uint8_t audio_pattern[16];
+    uint8_t pitch;
+    bool pattern_loaded;
+    bool hires;
+    uint8_t planes;
+} regs_t;
+
+_Static_assert(sizeof(regs_t) % 8 == 0, "snapshots are compared a word at a time");
+
+// runs of differing bytes go on over equal gaps shorter than this , a new
+// run header would cost about as much as the gap
+#define MAX_GAP 4
+
+#define MAX_RING_BYTES (1u << 30)
+
+struct rewind{
+    uint8_t * snapshots[2];  // the newest frame and room for the next one , ram then regs_t
+    uint32_t ram_size;
+    uint32_t snapshot_size;
+    uint32_t max_delta;      // biggest delta encode_delta can write
+    uint32_t newest;         // index of the newest in snapshots
+    bool recorded;           // snapshots[newest] holds a frame
+    uint8_t * ring;          // deltas back to back , never wrapping in the middle of one
+    uint32_t ring_mask;      // ring size - 1
+    uint32_t head;           // ring position of the next delta , counts up and wraps at 2^32
+    uint32_t * starts;       // ring position of each delta , oldest at starts[first]
+    uint32_t frame_mask;     // starts size - 1
+    uint32_t first;
+    uint32_t count;
+};
+
+static uint32_t round_up_pow2(uint32_t n){
+    return n <= 1 ? 1 : 1u << (32 - __builtin_clz(n - 1));
+}
+
+rewind_t * rewind_create(uint32_t bytes, uint32_t frames, uint32_t ram_size){
+    // every run after the first is behind at least MAX_GAP skipped bytes ,
+    // which pays for its header
+    const uint32_t snapshot_size = ram_size + sizeof(regs_t);
+    const uint32_t max_delta = snapshot_size + 8;
+
+    if(bytes < max_delta) bytes = max_delta;
+    if(bytes > MAX_RING_BYTES) bytes = MAX_RING_BYTES;
+    if(frames > MAX_RING_BYTES / sizeof(uint32_t)) frames = MAX_RING_BYTES / sizeof(uint32_t);
+
+    rewind_t * history = calloc(1, sizeof(*history));
+    if(!history) return NULL;
+
+    history->ram_size = ram_size;
+    history->snapshot_size = snapshot_size;
+    history->max_delta = max_delta;
+    history->ring_mask = round_up_pow2(bytes) - 1;
+    history->frame_mask = round_up_pow2(frames) - 1;
+    history->ring = malloc(history->ring_mask + 1);
+    history->starts = malloc((history->frame_mask + 1) * sizeof(uint32_t));
+    history->snapshots[0] = calloc(2, snapshot_size);
+    history->snapshots[1] = history->snapshots[0] ? history->snapshots[0] + snapshot_size : NULL;
+    if(!history->ring || !history->starts || !history->snapshots[0]){
+        rewind_destroy(history);
+        return NULL;
+    }
+    return history;
+}
+
+void rewind_destroy(rewind_t * history){
+    if(!history) return;
+    free(history->ring);
+    free(history->starts);
+    free(history->snapshots[0]);
+    free(history);
+}
+
+static void save_snapshot(const rewind_t * history, uint8_t * bytes, const chip8_t * chip8){
+    regs_t * snapshot = (regs_t *) (bytes + history->ram_size);
+    memcpy(bytes, chip8_ram(chip8), history->ram_size);
+    memcpy(snapshot->display, chip8->display, sizeof(snapshot->display));
+    memcpy(snapshot->display2, chip8->display2, sizeof(snapshot->display2));
+    snapshot->planes = chip8->planes;
+    memcpy(snapshot->stack, chip8->stack, sizeof(snapshot->stack));
+    memcpy(snapshot->V, chip8->V, sizeof(snapshot->V));
+    memcpy(snapshot->flags, chip8->flags, sizeof(snapshot->flags));
+    snapshot->hires = chip8->hires;
+    snapshot->I = chip8->I;
+    snapshot->PC = chip8->PC;
+    snapshot->stack_depth = chip8->SP;
+    snapshot->delay_timer = chip8->delay_timer;
+    snapshot->sound_timer = chip8->sound_timer;
+    snapshot->wait_key = chip8->wait_key;
+    snapshot->rng = chip8->rng;
+    snapshot->cycle_debt = chip8->cycle_debt;
+    memcpy(snapshot->audio_pattern, chip8->audio_pattern, sizeof(snapshot->audio_pattern));
+    snapshot->pitch = chip8->pitch;
+    snapshot->pattern_loaded = chip8->pattern_loaded;
+}
+
+static void load_snapshot(const rewind_t * history, chip8_t * chip8, const uint8_t * bytes){
+    const regs_t * snapshot = (const regs_t *) (bytes + history->ram_size);
+    memcpy(chip8_ram(chip8), bytes, history->ram_size);
+    memcpy(chip8->display, snapshot->display, sizeof(chip8->display));
+    memcpy(chip8->display2, snapshot->display2, sizeof(chip8->display2));
+    chip8->planes = snapshot->planes;
+    memcpy(chip8->stack, snapshot->stack, sizeof(chip8->stack));
+    memcpy(chip8->V, snapshot->V, sizeof(chip8->V));
+    memcpy(chip8->flags, snapshot->flags, sizeof(chip8->flags));
+    chip8->hires = snapshot->hires;
+    chip8->I = snapshot->I;
+    chip8->PC = snapshot->PC;
+    chip8->SP = snapshot->stack_depth;
+    chip8->delay_timer = snapshot->delay_timer;
+    chip8->sound_timer = snapshot->sound_timer;
+    chip8->wait_key = snapshot->wait_key;
+    chip8->rng = snapshot->rng;
+    chip8->cycle_debt = snapshot->cycle_debt;
+    memcpy(chip8->audio_pattern, snapshot->audio_pattern, sizeof(chip8->audio_pattern));
+    chip8->pitch = snapshot->pitch;
+    chip8->pattern_loaded = snapshot->pattern_loaded;
+    chip8->idle_cycle = 0;
+    chip8->wait_vblank = 0; // snapshots are taken after the timers , never mid frame
+    chip8->dirty_rows = ~0ull;
+    // a frame that ended halted (00FD or a fault) is on that instruction ,
+    // which halts again as soon as it runs
+    chip8->fault = FAULT_NONE;
+    chip8->state = RUNNING;
+}
+
+static inline uint64_t load64(const uint8_t * p){
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint8_t * put_varint(uint8_t * p, uint32_t v){
+    for(; v >= 0x80; v >>= 7) *p++ = (v & 0x7F) | 0x80;
+    *p++ = v;
+    return p;
+}
+
+static uint32_t get_varint(const uint8_t ** p){
+    uint32_t v = 0;
+    for(uint32_t shift = 0;; shift += 7){
+        const uint8_t byte = *(*p)++;
+        v |= (uint32_t) (byte & 0x7F) << shift;
+        if(!(byte & 0x80)) return v;
+    }
+}
+
+// a xor b as runs of (bytes skipped , bytes in the run , the xored bytes) ,
+// ended by an empty run. returns the bytes written to out
+static uint32_t encode_delta(const uint8_t * a, const uint8_t * b, uint32_t size, uint8_t * out){
+    uint8_t * p = out;
+    uint32_t i = 0, done = 0;
+
+    for(;;){
+        // most of a frame is the same as the last one , skip it a word at a time
+        while(i + 8 <= size && load64(a + i) == load64(b + i)) i += 8;
+        while(i < size && a[i] == b[i]) i++;
+        if(i == size) break;
+
+        uint32_t end = i + 1;
+        for(uint32_t j = end; j < size && j - end < MAX_GAP; j++)
+            if(a[j] != b[j]) end = j + 1;
+
+        p = put_varint(p, i - done);
+        p = put_varint(p, end - i);
+        for(; i < end; i++) *p++ = a[i] ^ b[i];
+        done = end;
+    }
+
+    p = put_varint(p, 0);
+    p = put_varint(p, 0);
+    return p - out;
+}
+
+// xor a delta back into a snapshot. ram it touches is reported to the machine
+// so decoded instructions and jit blocks from the later frame are dropped
+static void apply_delta(uint8_t * snapshot, const uint8_t * delta, uint32_t ram_size, chip8_t * chip8){
+    for(uint32_t i = 0;;){
+        i += get_varint(&delta);
+        const uint32_t len = get_varint(&delta);
+        if(!len) return;
+
+        for(uint32_t j = 0; j < len; j++) snapshot[i + j] ^= *delta++;
+        if(i < ram_size) ram_written(chip8, i, (i + len > ram_size ? ram_size : i + len) - i);
+        i += len;
+    }
+}
+
+static void drop_oldest(rewind_t * history){
+    history->first = (history->first + 1) & history->frame_mask;
+    history->count--;
+}
+
+void rewind_record(rewind_t * history, const chip8_t * chip8){
+    const uint8_t * newest = history->snapshots[history->newest];
+    uint8_t * next = history->snapshots[history->newest ^ 1];
+    save_snapshot(history, next, chip8);
+
+    if(history->recorded){
+        if(history->count > history->frame_mask) drop_oldest(history);
+
+        // a delta is never split over the end of the ring , skip to the start
+        const uint32_t ring_size = history->ring_mask + 1;
+        if((history->head & history->ring_mask) + history->max_delta > ring_size)
+            history->head = (history->head | history->ring_mask) + 1;
+        while(history->count && history->head + history->max_delta - history->starts[history->first] > ring_size)
+            drop_oldest(history);
+
+        history->starts[(history->first + history->count) & history->frame_mask] = history->head;
+        history->head += encode_delta(next, newest, history->snapshot_size,
+                                      history->ring + (history->head & history->ring_mask));
+        history->count++;
+    }
+
+    history->newest ^= 1;
+    history->recorded = true;
+}
+
+bool rewind_step(rewind_t * history, chip8_t * chip8){
+    if(!history->count) return false;
+
+    history->count--;
+    history->head = history->starts[(history->first + history->count) & history->frame_mask];
+
+    uint8_t * newest = history->snapshots[history->newest];
+    apply_delta(newest, history->ring + (history->head & history->ring_mask), history->ram_size, chip8);
+    load_snapshot(history, chip8, newest);
+    return true;
+}
+
+uint32_t rewind_frames(const rewind_t * history){
+    return history->count;
+}
+
+uint32_t rewind_bytes(const rewind_t * history){
+    return history->count ? history->head - history->starts[history->first] : 0;
+}
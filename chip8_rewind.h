@@ -0,0 +1,37 @@
+#ifndef CHIP8_REWIND_H
+#define CHIP8_REWIND_H
+
+// rewind history , one snapshot of the machine per frame
+//
+// only the newest snapshot is kept whole. every older frame is an xor of it
+// against the frame after it , run length coded , so a frame where a few
+// registers and display rows changed costs tens of bytes. stepping back pops
+// the newest delta and applies it. the deltas live in one byte ring , when
+// it's full the oldest frames are dropped
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "chip8_core.h"
+
+#define REWIND_DEFAULT_FRAMES (1u << 16) // at most this many frames back (18 min at 60hz)
+
+typedef struct rewind rewind_t;
+
+// ring of bytes holding at most frames deltas (both rounded up to powers of two)
+// of a machine with ram_size bytes of ram (see ram_size()) , NULL when out of memory
+rewind_t * rewind_create(uint32_t bytes, uint32_t frames, uint32_t ram_size);
+void rewind_destroy(rewind_t * history);
+
+// snapshot the machine , once per frame
+void rewind_record(rewind_t * history, const chip8_t * chip8);
+
+// put the machine back to the frame before the newest snapshot , which is
+// dropped. false (machine untouched) when there is no older frame
+bool rewind_step(rewind_t * history, chip8_t * chip8);
+
+// frames that can be stepped back , and the bytes their deltas use
+uint32_t rewind_frames(const rewind_t * history);
+uint32_t rewind_bytes(const rewind_t * history);
+
+#endif
@@ -0,0 +1,326 @@
+// headless runner , runs a rom with no window and no frame cap
+// and reports how fast the core went
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8_core.h"
+#include "chip8_jit.h"
+#include "chip8_movie.h"
+#include "chip8_record.h"
+#include "chip8_profile.h"
+
+static void usage(const char * prog){
+    fprintf(stderr,
+        "Usage %s [options] <rom_name>\n"
+        "  -i N   run N instructions\n"
+        "  -f N   run N frames (default 600 , 10 seconds of chip8 time)\n"
+        "  -c N   instructions per second of the emulated clock (default 700)\n"
+        "  -V     COSMAC VIP timing , each opcode costs its VIP cycles and DXYN waits\n"
+        "         for the next frame , -c is ignored\n"
+        "  -e S   quirks of chip8 , schip or xochip (default chip8)\n"
+        "  -s N   seed for CXNN random numbers (default time)\n"
+        "  -m F   play an input movie , with its seed , clock and quirks , for its\n"
+        "         length unless -i or -f is given\n"
+        "  -n     no decode cache , decode every instruction\n"
+        "  -j     run through the x86-64 jit\n"
+        "  -b N   max chip8 instructions per jit block\n"
+        "  -v     check the jit against the interpreter after every block\n"
+        "  -R F   record the frames to F (.y4m , .gif , anything else raw rgba 128x64)\n"
+        "  -T F   record an instruction trace to F (not with -j)\n",
+        prog);
+}
+
+static double now_seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_state(const char * name, const chip8_t * chip8){
+    printf("%-12s PC=%03X I=%03X SP=%d DT=%02X ST=%02X V=", name, chip8->PC, chip8->I,
+           chip8->SP, chip8->delay_timer, chip8->sound_timer);
+    for(int i = 0; i < 16; i++) printf("%02X", chip8->V[i]);
+    printf("\n");
+}
+
+static bool same_state(const chip8_t * a, const chip8_t * b){
+    return a->PC == b->PC && a->I == b->I &&
+           a->delay_timer == b->delay_timer && a->sound_timer == b->sound_timer &&
+           a->SP == b->SP && a->rng == b->rng && a->hires == b->hires &&
+           a->pitch == b->pitch && a->pattern_loaded == b->pattern_loaded &&
+           memcmp(a->audio_pattern, b->audio_pattern, sizeof(a->audio_pattern)) == 0 &&
+           memcmp(a->flags, b->flags, sizeof(a->flags)) == 0 &&
+           memcmp(a->V, b->V, sizeof(a->V)) == 0 &&
+           memcmp(a->stack, b->stack, sizeof(a->stack)) == 0 &&
+           a->planes == b->planes && ram_size(a) == ram_size(b) &&
+           memcmp(chip8_ram(a), chip8_ram(b), ram_size(a)) == 0 &&
+           memcmp(a->display, b->display, sizeof(a->display)) == 0 &&
+           memcmp(a->display2, b->display2, sizeof(a->display2)) == 0;
+}
+
+// run the jit machine block by block next to a plain interpreter copy and stop
+// at the first difference. the copy starts with the same CXNN random state
+static bool verify_jit(jit_t * jit, chip8_t * chip8, const config_t * config, uint64_t max_frames){
+    chip8_t ref = *chip8;
+    ref.decode_cache = NULL;
+    ref.write_hook = NULL;
+
+    // the copy needs its own 64 KB
+    uint8_t * ref_ram = NULL;
+    if(chip8->xo_ram){
+        ref_ram = malloc(XO_RAM_SIZE);
+        if(!ref_ram){
+            fprintf(stderr, "Out of memory for the xo-chip ram\n");
+            return false;
+        }
+        memcpy(ref_ram, chip8->xo_ram, XO_RAM_SIZE);
+        ref.xo_ram = ref_ram;
+    }
+
+    const uint32_t inst_per_frame = config->inst_per_second / 60;
+    uint64_t instructions = 0, target = 0, blocks = 0;
+
+    for(uint64_t frame = 0; frame < max_frames && chip8->state != QUIT; frame++){
+        target += inst_per_frame;
+        while(instructions < target){
+            const uint16_t block_pc = chip8->PC;
+            chip8_t before = ref;
+
+            const uint32_t ran = jit_step(jit, chip8, config);
+            for(uint32_t i = 0; i < ran; i++) emulate_instruction(&ref, config);
+
+            if(!same_state(chip8, &ref)){
+                printf("verify FAILED at block %llu (PC=%03X , %u instructions , %llu in)\n",
+                       (unsigned long long) blocks, block_pc, ran, (unsigned long long) instructions);
+                print_state("before", &before);
+                print_state("interpreter", &ref);
+                print_state("jit", chip8);
+                free(ref_ram);
+                return false;
+            }
+            instructions += ran;
+            blocks++;
+        }
+        update_timers(chip8);
+        update_timers(&ref);
+    }
+
+    printf("verify ok    %llu instructions in %llu blocks\n",
+           (unsigned long long) instructions, (unsigned long long) blocks);
+    free(ref_ram);
+    return true;
+}
+
+int main(int argc, char ** argv){
+    config_t config = {0};
+    init_config(&config);
+
+    uint64_t max_instructions = 0;
+    uint64_t max_frames = 600;
+    unsigned int seed = (unsigned int) time(NULL);
+    bool use_decode_cache = true;
+    bool use_jit = false;
+    bool verify = false;
+    uint32_t max_block = 0;
+    const char * movie_path = NULL;
+    const char * video_path = NULL;
+    const char * trace_path = NULL;
+    bool length_given = false;
+
+    int opt;
+    while((opt = getopt(argc, argv, "i:f:c:Vs:njb:ve:m:R:T:")) != -1){
+        switch(opt){
+            case 'i': max_instructions = strtoull(optarg, NULL, 0); max_frames = 0; length_given = true; break;
+            case 'f': max_frames = strtoull(optarg, NULL, 0); max_instructions = 0; length_given = true; break;
+            case 'c': config.inst_per_second = strtoul(optarg, NULL, 0); break;
+            case 'V':
+                config.cycles_per_frame = VIP_CYCLES_PER_FRAME;
+                config.display_wait = true;
+                break;
+            case 'e':
+                if(!parse_extension(optarg, &config.current_extension)) return EXIT_FAILURE;
+                break;
+            case 's': seed = strtoul(optarg, NULL, 0); break;
+            case 'n': use_decode_cache = false; break;
+            case 'j': use_jit = true; break;
+            case 'b': max_block = strtoul(optarg, NULL, 0); break;
+            case 'v': use_jit = verify = true; break;
+            case 'm': movie_path = optarg; break;
+            case 'R': video_path = optarg; break;
+            case 'T': trace_path = optarg; break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    // the movie's settings win , it only replays exactly with them
+    movie_t movie;
+    movie_init(&movie, seed, config.inst_per_second, config.current_extension);
+    if(movie_path){
+        if(!movie_load(&movie, movie_path)) return EXIT_FAILURE;
+        seed = movie.seed;
+        config.inst_per_second = movie.inst_per_second;
+        config.current_extension = movie.extension;
+        config.cycles_per_frame = movie.cycles_per_frame;
+        config.display_wait = movie.display_wait;
+        if(!length_given) max_frames = movie.frames;
+
+        // jit blocks run past the end of a frame , the keys would land late
+        if(use_jit){
+            fprintf(stderr, "Movies only replay exactly through the interpreter , drop -j\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(optind >= argc || config.inst_per_second < 60){
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // jit blocks run many instructions in one go , the trace needs each one
+    if(trace_path && use_jit){
+        fprintf(stderr, "Traces are only recorded through the interpreter , drop -j\n");
+        return EXIT_FAILURE;
+    }
+    // the cycle schedule prices every instruction as it runs , neither the
+    // jit's blocks nor the trace's single steps do
+    if(config.cycles_per_frame && (use_jit || trace_path)){
+        fprintf(stderr, "VIP timing only runs through the interpreter , without -j , -v or -T\n");
+        return EXIT_FAILURE;
+    }
+
+    // xo-chip programs get the whole 64 KB
+    chip8_t chip8 = {0};
+    uint8_t * xo_ram = NULL;
+    if(config.current_extension == XOCHIP){
+        xo_ram = calloc(1, XO_RAM_SIZE);
+        if(!xo_ram){
+            fprintf(stderr, "Out of memory for the xo-chip ram\n");
+            return EXIT_FAILURE;
+        }
+        attach_xo_ram(&chip8, xo_ram);
+    }
+    if(!init_chip8(&chip8, argv[optind])) return EXIT_FAILURE;
+
+    static decode_cache_t decode_cache;
+    if(use_decode_cache) attach_decode_cache(&chip8, &decode_cache);
+    seed_chip8(&chip8, seed);
+
+    jit_t * jit = NULL;
+    if(use_jit){
+        jit = jit_create(max_block);
+        if(!jit){
+            fprintf(stderr, "jit not available on this host\n");
+            return EXIT_FAILURE;
+        }
+        jit_attach(jit, &chip8);
+    }
+
+    if(verify){
+        const bool ok = verify_jit(jit, &chip8, &config, max_frames ? max_frames : 600);
+        jit_destroy(jit);
+        free(xo_ram);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    recorder_t * recorder = NULL;
+    if(video_path || trace_path){
+        recorder = recorder_create(video_path, trace_path, config.palette, 0, 0);
+        if(!recorder) return EXIT_FAILURE;
+    }
+
+    const interpreter_t * interpreter = select_interpreter(config.current_extension);
+    uint64_t instructions = 0;
+    uint64_t target = 0; // where the instruction count should be by the end of this frame
+    uint64_t frames = 0;
+    uint32_t inst_acc = 0, movie_cursor = 0;
+
+    const double start = now_seconds();
+
+    while(chip8.state != QUIT){
+        if(max_frames && frames >= max_frames) break;
+
+        // the same frame schedule as the front end , so movies replay exactly
+        const uint32_t inst_per_frame = frame_budget(config.inst_per_second, &inst_acc);
+        if(movie_path){
+            const uint16_t keys = movie_keys(&movie, frames, &movie_cursor);
+            for(uint8_t i = 0; i < 16; i++) chip8.keypads[i] = (keys >> i) & 1;
+        }
+
+        // frames are whole on the cycle schedule , -i stops after the one reaching it
+        if(config.cycles_per_frame){
+            if(max_instructions && instructions >= max_instructions) break;
+            instructions += interpreter->run_cycles(&chip8, &config, config.cycles_per_frame);
+            update_timers(&chip8);
+            if(recorder) recorder_frame(recorder, &chip8);
+            frames++;
+            continue;
+        }
+
+        uint32_t budget = inst_per_frame;
+        if(max_instructions){
+            if(target >= max_instructions) break;
+            if(max_instructions - target < budget) budget = max_instructions - target;
+        }
+        target += budget;
+
+        // a jit block can run past the budget , the overshoot comes off the next frame
+        if(jit){
+            if(instructions < target) instructions += jit_run(jit, &chip8, &config, target - instructions);
+        }
+        else if(trace_path){
+            if(instructions < target) instructions += recorder_run(recorder, interpreter, &chip8, &config, target - instructions);
+        }
+        else {
+            for(; instructions < target && chip8.state != QUIT; instructions++) interpreter->step(&chip8, &config);
+        }
+
+        // only a full frame ticks the 60hz timers
+        if(budget == inst_per_frame){
+            update_timers(&chip8);
+            if(recorder) recorder_frame(recorder, &chip8);
+            frames++;
+        }
+    }
+
+    const double elapsed = now_seconds() - start;
+
+    printf("rom          %s\n", chip8.rom_name);
+    printf("seed         %u\n", seed);
+    printf("instructions %llu\n", (unsigned long long) instructions);
+    printf("frames       %llu\n", (unsigned long long) frames);
+    printf("seconds      %.6f\n", elapsed);
+    printf("inst/sec     %.0f (%.2f MIPS)\n",
+           elapsed > 0 ? instructions / elapsed : 0.0,
+           elapsed > 0 ? instructions / elapsed / 1e6 : 0.0);
+    printf("state        PC=%03X I=%03X display=%08X\n", chip8.PC, chip8.I, display_hash(&chip8));
+    if(chip8.fault) printf("fault        %s at %03X\n", fault_name(chip8.fault), chip8.PC);
+    printf("V           ");
+    for(int i = 0; i < 16; i++) printf(" %02X", chip8.V[i]);
+    printf("\n");
+
+    if(recorder){
+        record_stats_t stats;
+        recorder_stats(recorder, &stats);
+        printf("recorded     %llu frames (%llu dropped) , %llu trace records (%llu dropped)\n",
+               (unsigned long long) stats.frames, (unsigned long long) stats.frames_dropped,
+               (unsigned long long) stats.trace, (unsigned long long) stats.trace_dropped);
+    }
+    const bool recorded = recorder_destroy(recorder);
+
+    PROFILE_REPORT(stdout, "chip8_profile.json");
+
+    jit_destroy(jit);
+    movie_free(&movie);
+    free(xo_ram);
+    return recorded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
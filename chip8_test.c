@@ -0,0 +1,478 @@
+// regression tests for the core , no SDL needed. make test builds and runs
+// them , the exit status is the number of failed checks
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "chip8_core.h"
+#include "chip8_fork.h"
+#include "chip8_lanes.h"
+#include "chip8_rewind.h"
+
+static int failures;
+
+#define CHECK(cond) do{ \
+        if(!(cond)){ \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while(0)
+
+// a fresh 4 KB machine with rom loaded at 0x200 and a decode cache
+static void load(chip8_t * chip8, decode_cache_t * cache, const uint8_t * rom, size_t size){
+    memset(chip8, 0, sizeof(*chip8));
+    init_chip8_image(chip8, rom, size, "test");
+    attach_decode_cache(chip8, cache);
+}
+
+static void run(chip8_t * chip8, const config_t * config, uint32_t count){
+    const interpreter_t * interpreter = select_interpreter(config->current_extension);
+    for(uint32_t i = 0; i < count && chip8->state != QUIT; i++) interpreter->step(chip8, config);
+}
+
+// FX55 at I = FFF wraps to 0 , where a call then goes. the write has to be
+// seen there too , by the page masks and the decoded instructions
+static const uint8_t wrap_rom[] = {
+    0xAF, 0xFF, // 200 I = FFF
+    0x60, 0xAA, // 202
+    0x61, 0x12, // 204
+    0x62, 0x20, // 206
+    0xF2, 0x55, // 208 FFF = AA , 1220 at 0
+    0x20, 0x00, // 20A call 0 , a jump to 220
+    0x63, 0x01, // 20C V3 = 1 , what ran at 0 was stale
+    0x12, 0x0C, // 20E
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0x63, 0x02, // 220 V3 = 2
+    0x12, 0x22, // 222
+};
+
+// the same , but 0 already ran (and got decoded) as a return first
+static const uint8_t wrap_decoded_rom[] = {
+    0xA0, 0x00, // 200 I = 0
+    0x60, 0x00, // 202 V0 = 00
+    0x61, 0xEE, // 204 V1 = EE
+    0xF1, 0x55, // 206 00EE at 0
+    0x20, 0x00, // 208 call 0 , decodes the return there
+    0xAF, 0xFF, // 20A I = FFF
+    0x60, 0xAA, // 20C
+    0x61, 0x12, // 20E
+    0x62, 0x20, // 210
+    0xF2, 0x55, // 212 FFF = AA , 1220 at 0
+    0x20, 0x00, // 214 call 0 , now a jump to 220
+    0x63, 0x01, // 216 V3 = 1 , the stale return came back
+    0x12, 0x16, // 218
+    0, 0, 0, 0, 0, 0,
+    0x63, 0x02, // 220 V3 = 2
+    0x12, 0x22, // 222
+};
+
+static void test_wrapped_write_decoded(void){
+    static chip8_t chip8;
+    static decode_cache_t cache;
+    config_t config = {0};
+    init_config(&config);
+    load(&chip8, &cache, wrap_decoded_rom, sizeof(wrap_decoded_rom));
+
+    run(&chip8, &config, 20);
+    CHECK(chip8.V[3] == 2);
+    CHECK(chip8.ram[0xFFF] == 0xAA);
+    CHECK(chip8.ram[0] == 0x12);
+}
+
+// a restore puts back the pages written since the clone , 0 among them
+static void test_wrapped_write_fork(void){
+    static chip8_t chip8;
+    static decode_cache_t cache;
+    config_t config = {0};
+    init_config(&config);
+    load(&chip8, &cache, wrap_rom, sizeof(wrap_rom));
+
+    fork_pool_t * pool = fork_pool_create();
+    fork_t * start = pool ? fork_clone(pool, &chip8) : NULL;
+    CHECK(start != NULL);
+    if(!start) return;
+
+    run(&chip8, &config, 10);
+    CHECK(chip8.V[3] == 2);
+    CHECK(chip8.written_pages & 1);
+
+    fork_restore(pool, &chip8, start);
+    CHECK(chip8.ram[0] == 0xF0); // the font is back
+    CHECK(chip8.ram[1] == 0x90);
+    CHECK(chip8.ram[0xFFF] == 0);
+
+    fork_release(pool, start);
+    fork_detach(pool, &chip8);
+    fork_pool_destroy(pool);
+}
+
+// lanes fetch from the rom image until a page is written
+static void test_wrapped_write_lanes(void){
+    config_t config = {0};
+    init_config(&config);
+    lanes_t * lanes = lanes_create(2);
+    CHECK(lanes != NULL);
+    if(!lanes) return;
+
+    CHECK(lanes_load(lanes, 2, wrap_rom, sizeof(wrap_rom), "test"));
+    lanes_run(lanes, &config, 10);
+    for(uint32_t lane = 0; lane < 2; lane++) CHECK(lanes_machine(lanes, lane)->V[3] == 2);
+    lanes_destroy(lanes);
+}
+
+static void count_written(void * userdata, uint16_t addr, uint32_t len){
+    (void)addr;
+    *(uint32_t *) userdata += len;
+}
+
+// loading a 64 KB xo-chip machine reports all of its ram , not 0x10000 bytes cut to 0
+static void test_xo_load_written(void){
+    static chip8_t chip8;
+    static uint8_t xo_ram[XO_RAM_SIZE];
+    static const uint8_t rom[] = { 0x12, 0x00 };
+    uint32_t written = 0;
+
+    memset(&chip8, 0, sizeof(chip8));
+    attach_xo_ram(&chip8, xo_ram);
+    set_ram_write_hook(&chip8, count_written, &written);
+    init_chip8_image(&chip8, rom, sizeof(rom), "test");
+    CHECK(written == XO_RAM_SIZE);
+    CHECK(chip8.written_pages == 0xFFFFFFFFu);
+}
+
+// I past 1FFF on a 4 KB machine (FX1E adds up) still marks the page the
+// write wraps to , the page shift used to run past 63
+static void test_write_far_past_ram(void){
+    static chip8_t chip8;
+    static decode_cache_t cache;
+    static const uint8_t rom[] = {
+        0xAF, 0xFF, // 200 I = FFF
+        0x60, 0xFF, // 202 V0 = FF
+        0x61, 0x12, // 204 V1 = 12 , 18 times round
+        0xF0, 0x1E, // 206 I += FF
+        0x71, 0xFF, // 208 V1 -= 1
+        0x31, 0x00, // 20A
+        0x12, 0x06, // 20C
+        0xF0, 0x33, // 20E BCD at I = 21ED , 01ED
+        0x12, 0x10, // 210
+    };
+    config_t config = {0};
+    init_config(&config);
+    load(&chip8, &cache, rom, sizeof(rom));
+    chip8.written_pages = 0;
+
+    run(&chip8, &config, 3 + 18 * 4 + 1);
+    CHECK(chip8.I == 0x21ED);
+    CHECK(chip8.ram[0x1ED] == 2 && chip8.ram[0x1EE] == 5 && chip8.ram[0x1EF] == 5);
+    CHECK(chip8.written_pages == 1u << (0x1ED >> RAM_PAGE_SHIFT));
+
+    chip8.written_pages = 0;
+    ram_written(&chip8, 0x2FFF, 2); // straight in , wrapping too
+    CHECK(chip8.written_pages == (1u | 1u << (0xFFF >> RAM_PAGE_SHIFT)));
+}
+
+// the delay timer wait loop run skips has to land where stepping through it
+// would , whatever the budget's remainder against the loop is
+static void test_idle_skip_lands(void){
+    static chip8_t run_out, skipped;
+    static decode_cache_t cache_a, cache_b;
+    static const uint8_t rom[] = {
+        0x60, 0x05, // 200 V0 = 5
+        0xF0, 0x15, // 202 delay = 5
+        0xF0, 0x07, // 204 V0 = delay
+        0x30, 0x00, // 206 until it's 0
+        0x12, 0x04, // 208
+        0x61, 0x99, // 20A
+        0x12, 0x0C, // 20C
+    };
+    config_t config = {0};
+    init_config(&config);
+    const interpreter_t * interpreter = select_interpreter(config.current_extension);
+
+    for(uint32_t budget = 7; budget <= 9; budget++){
+        load(&run_out, &cache_a, rom, sizeof(rom));
+        load(&skipped, &cache_b, rom, sizeof(rom));
+        for(uint32_t frame = 0; frame < 8; frame++){
+            run(&run_out, &config, budget);
+            interpreter->run(&skipped, &config, budget);
+            CHECK(skipped.PC == run_out.PC);
+            CHECK(memcmp(skipped.V, run_out.V, sizeof(skipped.V)) == 0);
+            update_timers(&run_out);
+            update_timers(&skipped);
+        }
+        CHECK(run_out.V[1] == 0x99 && skipped.V[1] == 0x99);
+    }
+}
+
+// the program visible state of two machines matches , ram , display and registers
+static bool same_machine(const chip8_t * a, const chip8_t * b){
+    return memcmp(chip8_ram(a), chip8_ram(b), ram_size(a)) == 0 &&
+           memcmp(a->display, b->display, sizeof(a->display)) == 0 &&
+           memcmp(a->display2, b->display2, sizeof(a->display2)) == 0 &&
+           memcmp(a->V, b->V, sizeof(a->V)) == 0 &&
+           memcmp(a->stack, b->stack, sizeof(a->stack)) == 0 &&
+           a->I == b->I && a->PC == b->PC && a->SP == b->SP && a->rng == b->rng &&
+           a->delay_timer == b->delay_timer && a->sound_timer == b->sound_timer;
+}
+
+// random numbers , BCD writes , draws and the timers , all of it changing
+// every frame
+static const uint8_t busy_rom[] = {
+    0xA3, 0x00, // 200 I = 300
+    0xC0, 0xFF, // 202 V0 = random
+    0xF0, 0x33, // 204 BCD at I
+    0xF0, 0x1E, // 206 I += V0
+    0xD0, 0x15, // 208 draw at V0 , V1
+    0x71, 0x01, // 20A
+    0xF1, 0x15, // 20C delay = V1
+    0x12, 0x02, // 20E
+};
+
+// stepping back through the history gives every recorded frame back as it was
+static void test_rewind_round_trip(void){
+    static chip8_t chip8, frames[10];
+    static decode_cache_t cache;
+    config_t config = {0};
+    init_config(&config);
+    load(&chip8, &cache, busy_rom, sizeof(busy_rom));
+
+    rewind_t * history = rewind_create(1u << 20, 64, ram_size(&chip8));
+    CHECK(history != NULL);
+    if(!history) return;
+
+    for(uint32_t f = 0; f < 10; f++){
+        rewind_record(history, &chip8);
+        frames[f] = chip8;
+        run(&chip8, &config, 13);
+        update_timers(&chip8);
+    }
+    rewind_record(history, &chip8);
+    CHECK(rewind_frames(history) == 10);
+
+    for(uint32_t f = 10; f-- > 0;){
+        CHECK(rewind_step(history, &chip8));
+        CHECK(same_machine(&chip8, &frames[f]));
+    }
+    CHECK(!rewind_step(history, &chip8));
+    CHECK(same_machine(&chip8, &frames[0]));
+
+    // and runs on from there the same way
+    run(&chip8, &config, 13);
+    CHECK(memcmp(chip8.display, frames[1].display, sizeof(chip8.display)) == 0);
+    rewind_destroy(history);
+}
+
+// forks of one machine don't see each other's writes , and restoring one
+// doesn't disturb the rest
+static void test_fork_isolation(void){
+    static chip8_t chip8, at_start, at_ten;
+    static decode_cache_t cache;
+    config_t config = {0};
+    init_config(&config);
+    load(&chip8, &cache, busy_rom, sizeof(busy_rom));
+
+    fork_pool_t * pool = fork_pool_create();
+    CHECK(pool != NULL);
+    if(!pool) return;
+
+    fork_t * start = fork_clone(pool, &chip8);
+    at_start = chip8;
+    run(&chip8, &config, 10 * 13);
+    fork_t * ten = fork_clone(pool, &chip8);
+    at_ten = chip8;
+    CHECK(start && ten);
+    if(!start || !ten) return;
+
+    // a branch off each , writing over the same pages
+    run(&chip8, &config, 5 * 13);
+    CHECK(!same_machine(&chip8, &at_ten));
+    fork_restore(pool, &chip8, start);
+    CHECK(same_machine(&chip8, &at_start));
+    run(&chip8, &config, 3 * 13);
+
+    fork_restore(pool, &chip8, ten);
+    CHECK(same_machine(&chip8, &at_ten));
+    fork_restore(pool, &chip8, start);
+    CHECK(same_machine(&chip8, &at_start));
+
+    // released forks leave the others whole
+    fork_release(pool, start);
+    run(&chip8, &config, 7 * 13);
+    fork_restore(pool, &chip8, ten);
+    CHECK(same_machine(&chip8, &at_ten));
+
+    fork_release(pool, ten);
+    fork_detach(pool, &chip8);
+    fork_pool_destroy(pool);
+}
+
+// a filled w x h box with its top left corner at x , y and nothing around it
+static bool box_at(const chip8_t * chip8, uint32_t x, uint32_t y, uint32_t w, uint32_t h){
+    for(uint32_t py = 0; py < display_height(chip8); py++)
+        for(uint32_t px = 0; px < display_width(chip8); px++){
+            const bool inside = px >= x && px < x + w && py >= y && py < y + h;
+            if(display_pixel(chip8, px, py) != inside) return false;
+        }
+    return true;
+}
+
+// super-chip hires , a 16x16 sprite across the two words of a row , then the
+// scrolls moving it down , right and left over that boundary
+static void test_schip_scroll(void){
+    static chip8_t chip8;
+    static decode_cache_t cache;
+    static const uint8_t rom[] = {
+        0x00, 0xFF, // 200 hires
+        0xA2, 0x20, // 202 I = 220
+        0x60, 0x38, // 204 V0 = 56
+        0x61, 0x02, // 206 V1 = 2
+        0xD0, 0x10, // 208 16x16 at 56 , 2
+        0x00, 0xC3, // 20A down 3
+        0x00, 0xFB, // 20C right 4
+        0x00, 0xFC, // 20E left 4
+        0x00, 0xFC, // 210 left 4
+        0xD0, 0x10, // 212 again at 56 , 2 , overlapping
+        0x12, 0x14, // 214
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, // 220 solid 16x16
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    };
+    config_t config = {0};
+    init_config(&config);
+    config.current_extension = SUPERCHIP;
+    load(&chip8, &cache, rom, sizeof(rom));
+
+    run(&chip8, &config, 5);
+    CHECK(chip8.hires);
+    CHECK(box_at(&chip8, 56, 2, 16, 16));
+    CHECK(chip8.V[0xF] == 0);
+    run(&chip8, &config, 1);
+    CHECK(box_at(&chip8, 56, 5, 16, 16));
+    run(&chip8, &config, 1);
+    CHECK(box_at(&chip8, 60, 5, 16, 16));
+    run(&chip8, &config, 1);
+    CHECK(box_at(&chip8, 56, 5, 16, 16));
+    run(&chip8, &config, 1);
+    CHECK(box_at(&chip8, 52, 5, 16, 16));
+
+    // the overlap is erased and flagged , 52..55 and 68..71 are left
+    run(&chip8, &config, 1);
+    CHECK(chip8.V[0xF] == 1);
+    CHECK(display_pixel(&chip8, 52, 5) && !display_pixel(&chip8, 56, 5) && display_pixel(&chip8, 68, 5));
+    CHECK(display_pixel(&chip8, 60, 2) && !display_pixel(&chip8, 60, 10) && display_pixel(&chip8, 60, 19));
+}
+
+// xo-chip register ranges to ram and back in both directions , then drawing
+// and clearing with each plane selection
+static void test_xo_ranges_and_planes(void){
+    static chip8_t chip8;
+    static decode_cache_t cache;
+    static const uint8_t rom[] = {
+        0x60, 0x11, // 200
+        0x61, 0x22, // 202
+        0x62, 0x33, // 204
+        0xA3, 0x00, // 206 I = 300
+        0x50, 0x22, // 208 V0..V2 to 300
+        0xA3, 0x10, // 20A I = 310
+        0x52, 0x02, // 20C V2..V0 to 310 , reversed
+        0x53, 0x53, // 20E V3..V5 from 310
+        0xF2, 0x01, // 210 plane 2 only
+        0xA0, 0x00, // 212 I = font 0
+        0x66, 0x00, // 214
+        0x67, 0x00, // 216
+        0xD6, 0x75, // 218 0 in plane 2
+        0xF1, 0x01, // 21A plane 1 only
+        0x00, 0xE0, // 21C clears plane 1 , not 2
+        0xF3, 0x01, // 21E both
+        0xD6, 0x75, // 220 0 in plane 1 , 1 (the next 5 bytes) over plane 2
+        0x12, 0x22, // 222
+    };
+    config_t config = {0};
+    init_config(&config);
+    config.current_extension = XOCHIP;
+    load(&chip8, &cache, rom, sizeof(rom));
+
+    run(&chip8, &config, 8);
+    CHECK(chip8.ram[0x300] == 0x11 && chip8.ram[0x301] == 0x22 && chip8.ram[0x302] == 0x33);
+    CHECK(chip8.ram[0x310] == 0x33 && chip8.ram[0x311] == 0x22 && chip8.ram[0x312] == 0x11);
+    CHECK(chip8.V[3] == 0x33 && chip8.V[4] == 0x22 && chip8.V[5] == 0x11);
+    CHECK(chip8.I == 0x310);
+
+    run(&chip8, &config, 5);
+    CHECK(chip8.display[0][0] == 0 && chip8.display[4][0] == 0);
+    CHECK(chip8.display2[0][0] == 0xF0ull << 56 && chip8.display2[1][0] == 0x90ull << 56);
+
+    run(&chip8, &config, 2);
+    CHECK(chip8.display2[0][0] == 0xF0ull << 56);
+
+    run(&chip8, &config, 2);
+    CHECK(chip8.display[0][0] == 0xF0ull << 56 && chip8.display[1][0] == 0x90ull << 56);
+    CHECK(chip8.display2[0][0] == (0xF0ull ^ 0x20) << 56 && chip8.display2[1][0] == (0x90ull ^ 0x60) << 56);
+    CHECK(chip8.V[0xF] == 1);
+}
+
+// the cycle schedule : the instruction crossing the budget is paid for by the
+// next call , and with display_wait a draw ends the frame until update_timers
+static void test_run_cycles(void){
+    static chip8_t chip8;
+    static decode_cache_t cache;
+    static const uint8_t count_rom[] = {
+        0x70, 0x01, // 200 10 cycles
+        0x12, 0x00, // 202 23 cycles
+    };
+    static const uint8_t draw_rom[] = {
+        0xA0, 0x00, // 200
+        0xD0, 0x05, // 202 draws , waits for vblank
+        0x70, 0x01, // 204
+        0x12, 0x02, // 206
+    };
+    config_t config = {0};
+    init_config(&config);
+    const interpreter_t * interpreter = select_interpreter(config.current_extension);
+
+    // 10+23+10+23+10+23+10 = 109 , 9 over
+    load(&chip8, &cache, count_rom, sizeof(count_rom));
+    CHECK(interpreter->run_cycles(&chip8, &config, 100) == 7);
+    CHECK(chip8.cycle_debt == 9 && chip8.V[0] == 4);
+    // 9 owed , 23+10+23+10+23+10 brings it to 108
+    CHECK(interpreter->run_cycles(&chip8, &config, 100) == 6);
+    CHECK(chip8.cycle_debt == 8 && chip8.V[0] == 7);
+
+    config.display_wait = true;
+    load(&chip8, &cache, draw_rom, sizeof(draw_rom));
+    CHECK(interpreter->run_cycles(&chip8, &config, 1000) == 2);
+    CHECK(chip8.wait_vblank);
+    CHECK(interpreter->run_cycles(&chip8, &config, 1000) == 0);
+    update_timers(&chip8);
+    CHECK(!chip8.wait_vblank);
+    CHECK(interpreter->run_cycles(&chip8, &config, 1000) == 3);
+    CHECK(chip8.V[0] == 1 && chip8.wait_vblank);
+
+    config.display_wait = false;
+    load(&chip8, &cache, draw_rom, sizeof(draw_rom));
+    CHECK(interpreter->run_cycles(&chip8, &config, 1000) > 3);
+    CHECK(!chip8.wait_vblank);
+}
+
+int main(void){
+    test_wrapped_write_decoded();
+    test_wrapped_write_fork();
+    test_wrapped_write_lanes();
+    test_xo_load_written();
+    test_write_far_past_ram();
+    test_idle_skip_lands();
+    test_rewind_round_trip();
+    test_fork_isolation();
+    test_schip_scroll();
+    test_xo_ranges_and_planes();
+    test_run_cycles();
+
+    if(failures) fprintf(stderr, "%d checks failed\n", failures);
+    else printf("all tests passed\n");
+    return failures;
+}